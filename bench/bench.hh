@@ -0,0 +1,47 @@
+#ifndef bench_bench_hh
+#define bench_bench_hh
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+
+/*
+ * Minimal benchmark harness, in the spirit of Google Benchmark.
+ *
+ * f() processes nevents events and bytes bytes of input per call,
+ * and is repeated until at least min_time seconds have passed.
+ * Reported are time per event, events/s and MB/s of input.
+ * f() should return something depending on its work, so that the
+ * compiler cannot drop it.
+ */
+
+namespace bench {
+
+constexpr double min_time = 0.5;
+
+template <typename F>
+void measure(const char* name, size_t nevents, size_t bytes, F&& f) {
+  using clock_type = std::chrono::steady_clock;
+  unsigned long long sink = 0, iters = 0;
+  double dt = 0;
+  const auto start = clock_type::now();
+  do {
+    sink += f();
+    ++iters;
+    dt = std::chrono::duration<double>(clock_type::now() - start).count();
+  } while (dt < min_time);
+
+  const double n = double(nevents)*iters;
+  std::cout << std::setw(32) << std::left << name << std::right
+            << std::fixed << std::setprecision(3)
+            << std::setw(10) << 1e9*dt/n << " ns"
+            << std::setprecision(1)
+            << std::setw(10) << 1e-6*n/dt << " M/s"
+            << std::setw(10) << 1e-6*bytes*iters/dt << " MB/s"
+            << "   (" << iters << " x, " << (sink & 0xFF) << ')'
+            << std::endl;
+}
+
+}
+
+#endif
@@ -0,0 +1,42 @@
+#!/bin/bash
+# End-to-end benchmark of signif on synthetic MxAOD-like files.
+#
+# usage: bench/e2e.sh [nevents per file] [jobs...]
+# Files are generated once in bench/data; events/s and MB/s are taken
+# from the --profile.json and --io.stats output of every run.
+
+set -e
+cd "$(dirname "$0")/.."
+
+n=${1:-1000000}
+shift || true
+jobs=${@:-1 $(nproc)}
+dir=bench/data
+
+make -s bin/signif bench
+mkdir -p $dir
+
+for f in data15 data16 mc_ggH mc_VBF; do
+  file=$dir/${f}_$n.root
+  [ -s $file ] && continue
+  bin/bench_mxaod $file $n $([[ $f == mc* ]] && echo mc)
+done
+
+cat > $dir/e2e.conf <<CONF
+data = $dir/data15_$n.root
+data = $dir/data16_$n.root
+mc = $dir/mc_ggH_$n.root
+mc = $dir/mc_VBF_$n.root
+output = $dir/e2e.root
+bins = bins.txt
+CONF
+
+for j in $jobs; do
+  out=$(bin/signif $dir/e2e.conf -j $j --io.stats --profile.json $dir/e2e.json)
+  events=$(sed -n 's/.*"events": \([0-9]*\).*/\1/p' $dir/e2e.json)
+  wall=$(sed -n 's/.*"wall": \([0-9.e+-]*\).*/\1/p' $dir/e2e.json)
+  mb=$(echo "$out" | sed -n 's/^I\/O: \([0-9.e+-]*\) MB in.*/\1/p')
+  awk -v j=$j -v n=$events -v t=$wall -v mb=${mb:-0} 'BEGIN {
+    printf "jobs %3d: %12d events in %8.3f s, %10.3g events/s, %8.1f MB/s\n",
+      j, n, t, n/t, mb/t }'
+done
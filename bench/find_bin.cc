@@ -0,0 +1,104 @@
+// Compare binner::find_bin against the original linear scan
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+
+#include "binner.hh"
+#include "static_binner.hh"
+
+using namespace std;
+
+struct count {
+  unsigned n = 0;
+  count& operator++() noexcept { ++n; return *this; }
+  count& operator+=(double) noexcept { ++n; return *this; }
+};
+
+// Original binner::find_bin: linear scan from the top
+template <typename Edge>
+unsigned find_bin_scan(const vector<Edge>& edges, Edge e) noexcept {
+  unsigned i = edges.size()-1;
+  for (;;--i) {
+    if (e >= edges[i]) {
+      ++i;
+      break;
+    }
+    if (i==0) break;
+  }
+  return i;
+}
+
+void report(const char* name, size_t n, double dt) {
+  cout << setw(28) << left << name << right
+       << setw(8) << fixed << setprecision(3) << 1e9*dt/n << " ns"
+       << setw(10) << setprecision(1) << 1e-6*n/dt << " M/s";
+}
+
+// Same edges as binner<count>(5,0.,100.)
+constexpr double edges5[] = { 0, 20, 40, 60, 80, 100 };
+
+template <typename F>
+void run(const char* name, const vector<double>& xs, F f) {
+  const auto start = chrono::steady_clock::now();
+  unsigned long sum = 0;
+  for (double x : xs) sum += f(x);
+  report(name, xs.size(), chrono::duration<double>(
+    chrono::steady_clock::now() - start).count());
+  cout << "   (" << sum << ')' << endl;
+}
+
+int main(int argc, char* argv[]) {
+  const size_t n = argc>1 ? atol(argv[1]) : 20000000;
+
+  mt19937 gen(42);
+  uniform_real_distribution<double> dist(-10.,110.);
+  vector<double> xs(n);
+  for (auto& x : xs) x = dist(gen);
+  const vector<float> xs_f(xs.begin(),xs.end());
+
+  for (unsigned nbins : {5, 20, 100, 1000}) {
+    cout << nbins << " bins" << endl;
+
+    binner<count> uniform(nbins,0.,100.);
+    const vector<double>& uniform_edges = uniform.edges();
+    binner<count> search(uniform_edges.begin(),uniform_edges.end());
+    const vector<double>& edges = search.edges();
+
+    run("  linear scan", xs,
+      [&](double x){ return find_bin_scan(edges,x); });
+    run("  branch-free search", xs,
+      [&](double x){ return search.find_bin(x); });
+    run("  uniform", xs,
+      [&](double x){ return uniform.find_bin(x); });
+    run("  fill (uniform)", xs,
+      [&](double x){ return uniform.fill(x); });
+    if (nbins==5) {
+      static_binner<count,double,6,edges5> fixed;
+      run("  static", xs,
+        [&](double x){ return fixed.find_bin(x); });
+      run("  fill (static)", xs,
+        [&](double x){ return fixed.fill(x); });
+    }
+
+    const auto start = chrono::steady_clock::now();
+    uniform.fill_n(xs.data(), xs.size(),
+      [](count& c, unsigned){ ++c; });
+    report("  fill_n (uniform)", xs.size(), chrono::duration<double>(
+      chrono::steady_clock::now() - start).count());
+    cout << endl;
+
+    if (edges.size() > binner<count,float>::bin_index_max_edges) continue;
+
+    binner<count,float> simd(edges.begin(),edges.end());
+    const auto start_simd = chrono::steady_clock::now();
+    simd.fill_n(xs_f.data(), xs_f.size(),
+      [](count& c, unsigned){ ++c; });
+    report("  fill_n (float, SIMD)", xs.size(), chrono::duration<double>(
+      chrono::steady_clock::now() - start_simd).count());
+    cout << endl;
+  }
+}
@@ -0,0 +1,161 @@
+// Micro-benchmarks of the hot paths of signif on synthetic columns
+
+#include <iostream>
+#include <vector>
+#include <random>
+#include <thread>
+#include <cmath>
+
+#include "bench.hh"
+#include "bin_index.hh"
+#include "bin_bank.hh"
+#include "binner.hh"
+#include "static_binner.hh"
+#include "cumulative.hh"
+#include "spsc_queue.hh"
+#include "expr.hh"
+
+using namespace std;
+
+// Accumulator of signif's original binner<bkg_sig>
+struct bkg_sig {
+  double bkg = 0, sig = 0;
+  void operator()(double w, bool mc) noexcept { (mc ? sig : bkg) += w; }
+};
+
+// pT_yy edges of bins.txt, in MeV of the branch
+const vector<float> pT_edges { 0, 40e3, 60e3, 100e3, 200e3 };
+constexpr float pT_edges_c[] = { 0, 40e3, 60e3, 100e3, 200e3 };
+
+int main(int argc, char* argv[]) {
+  const size_t n = argc>1 ? atol(argv[1]) : 1<<20;
+
+  // pT_yy falls off exponentially, N_j_30 is about Poisson
+  mt19937 gen(42);
+  exponential_distribution<float> pT(1./40e3);
+  poisson_distribution<int> nj(0.9);
+  normal_distribution<float> w_dist(1.,0.3);
+  vector<float> x(n), w(n);
+  vector<int> njets(n);
+  for (size_t k=0; k<n; ++k) {
+    x[k] = pT(gen);
+    w[k] = w_dist(gen);
+    njets[k] = nj(gen);
+  }
+  vector<unsigned> idx(n), idx2(n);
+  const size_t fbytes = n*sizeof(float);
+
+  cout << n << " events" << endl;
+
+  bench::measure("bin_index float", n, fbytes, [&]{
+    bin_index(pT_edges.data(), pT_edges.size(), x.data(), idx.data(), n);
+    return idx[n/2];
+  });
+  bench::measure("bin_index int", n, fbytes, [&]{
+    const float e[] = { 0, 1, 2, 3 };
+    bin_index(e, 4, njets.data(), idx2.data(), n);
+    return idx2[n/2];
+  });
+  bench::measure("bin_index float abs", n, fbytes, [&]{
+    bin_index<true>(pT_edges.data(), pT_edges.size(),
+                    x.data(), idx.data(), n);
+    return idx[n/2];
+  });
+
+  // derived variable, evaluated block by block as in the block binner
+  {
+    vector<expr_branch> branches;
+    const expr ratio("pT_yy/weight", branches);
+    const expr_value *cols[] = {
+      reinterpret_cast<const expr_value*>(x.data()),
+      reinterpret_cast<const expr_value*>(w.data())
+    };
+    const unsigned block = 4096;
+    vector<float> buf(block*ratio.stack_size());
+    bench::measure("expr pT_yy/weight + bin_index", n, 2*fbytes, [&]{
+      for (size_t k=0; k<n; k+=block) {
+        const unsigned m = min<size_t>(block,n-k);
+        const expr_value *c[] = { cols[0]+k, cols[1]+k };
+        ratio(c, buf.data(), m, buf.data()+m);
+        bin_index(pT_edges.data(), pT_edges.size(), buf.data(), idx.data()+k, m);
+      }
+      return idx[n/2];
+    });
+  }
+
+  bin_bank<float> bank;
+  bank.add(pT_edges.begin(), pT_edges.end());
+  bench::measure("bin_bank::find_bin", n, fbytes, [&]{
+    unsigned long s = 0;
+    for (size_t k=0; k<n; ++k) s += bank.find_bin(0,x[k]);
+    return s;
+  });
+
+  // weighted fill, as in the block filler: indices, then weights
+  vector<double> bins(pT_edges.size()+1);
+  bench::measure("bin_index + weighted fill", n, 2*fbytes, [&]{
+    bin_index(pT_edges.data(), pT_edges.size(), x.data(), idx.data(), n);
+    for (size_t k=0; k<n; ++k) bins[idx[k]] += w[k];
+    return size_t(bins[1]);
+  });
+
+  binner<bkg_sig,float> b(pT_edges);
+  bench::measure("binner<bkg_sig>::fill", n, 2*fbytes, [&]{
+    for (size_t k=0; k<n; ++k) b.fill(x[k], w[k], false);
+    return size_t(b[1].bkg);
+  });
+
+  static_binner<bkg_sig,float,5,pT_edges_c> sb;
+  bench::measure("static_binner<bkg_sig>::fill", n, 2*fbytes, [&]{
+    for (size_t k=0; k<n; ++k) sb.fill(x[k], w[k], false);
+    return size_t(sb[1].bkg);
+  });
+
+  // product pT_yy x N_j_30, flat index as in the block filler
+  {
+    bin_bank<float> pb;
+    pb.add(pT_edges.begin(), pT_edges.end());
+    const float nj_edges[] = { 0, 1, 2, 3 };
+    pb.add(nj_edges, nj_edges+4);
+    const unsigned axes[] = { 0, 1 };
+    pb.add_product(axes, axes+2);
+    vector<unsigned> flat(n);
+    vector<double> pbins(pb.product_size(0));
+    const unsigned s0 = pb.stride(0,0), s1 = pb.stride(0,1);
+    bench::measure("bin_bank product 2D fill", n, 3*fbytes, [&]{
+      bin_index(pb.edges(0), pb.nedges(0), x.data(), idx.data(), n);
+      bin_index(pb.edges(1), pb.nedges(1), njets.data(), idx2.data(), n);
+      for (size_t k=0; k<n; ++k) flat[k] = idx[k]*s0 + idx2[k]*s1;
+      for (size_t k=0; k<n; ++k) pbins[flat[k]] += w[k];
+      return size_t(pbins[s0+1]);
+    });
+  }
+
+  // readout of a coarse binning from 1000 fine bins
+  {
+    vector<float> fine(1001);
+    for (size_t i=0; i<fine.size(); ++i) fine[i] = i*200.;
+    vector<double> vals(fine.size()+1, 1.);
+    const cumulative<float> cum(fine.data(), fine.size(), vals.data());
+    bench::measure("cumulative::sum", pT_edges.size()-1, 0, [&]{
+      double s = 0;
+      for (size_t i=1; i<pT_edges.size(); ++i)
+        s += cum.sum(pT_edges[i-1], pT_edges[i]);
+      return size_t(s);
+    });
+  }
+
+  // hand-off of pointers between two threads, as in the pipeline
+  bench::measure("spsc_queue transfer", n, n*sizeof(void*), [&]{
+    spsc_queue<const float*> q(64);
+    size_t got = 0;
+    thread consumer([&]{
+      const float *p;
+      while (got < n) if (q.pop(p)) ++got; else this_thread::yield();
+    });
+    for (size_t k=0; k<n; ++k)
+      while (!q.push(&x[k])) this_thread::yield();
+    consumer.join();
+    return got;
+  });
+}
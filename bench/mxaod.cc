@@ -0,0 +1,112 @@
+// Synthetic MxAOD-like input for benchmarks of signif.
+//
+// Writes a CollectionTree with the HGamEventInfoAuxDyn branches read by
+// signif, and for MC a weighted cutflow histogram for the normalisation.
+// Data has a falling diphoton mass spectrum and mostly fails the
+// selection; MC has a peak at 125 GeV. Jet variables are -99 (GeV)
+// when there are not enough jets, as in the real files.
+//
+// usage: bench_mxaod file.root nevents [mc]
+
+#include <iostream>
+#include <string>
+#include <random>
+#include <cmath>
+#include <memory>
+
+#include <TFile.h>
+#include <TTree.h>
+#include <TH1.h>
+#include <TH1D.h>
+#include <TAxis.h>
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    cout << "usage: " << argv[0] << " file.root nevents [mc]" << endl;
+    return 1;
+  }
+  const string fname = argv[1];
+  const Long64_t nevents = atoll(argv[2]);
+  const bool mc = argc > 3 && string(argv[3]) == "mc";
+
+  unique_ptr<TFile> file(new TFile(fname.c_str(),"recreate"));
+  if (file->IsZombie()) {
+    cerr << "\033[31mcannot open " << fname << "\033[0m" << endl;
+    return 1;
+  }
+
+  TTree *tree = new TTree("CollectionTree","CollectionTree");
+
+  Char_t isPassed;
+  Float_t weight, cs_br_fe, m_yy, pT_yy, yAbs_yy, cosTS_yy,
+          pT_j1, m_jj, Dphi_j_j, Dy_j_j;
+  Int_t N_j_30, N_j_50;
+
+#define BRANCH(name, type) \
+  tree->Branch("HGamEventInfoAuxDyn." #name, &name, #name "/" #type);
+
+  BRANCH(isPassed, B)
+  BRANCH(weight, F)
+  BRANCH(m_yy, F)
+  BRANCH(pT_yy, F)
+  BRANCH(yAbs_yy, F)
+  BRANCH(cosTS_yy, F)
+  BRANCH(N_j_30, I)
+  BRANCH(N_j_50, I)
+  BRANCH(pT_j1, F)
+  BRANCH(m_jj, F)
+  BRANCH(Dphi_j_j, F)
+  BRANCH(Dy_j_j, F)
+#undef BRANCH
+  if (mc) tree->Branch("HGamEventInfoAuxDyn.crossSectionBRfilterEff",
+                       &cs_br_fe, "crossSectionBRfilterEff/F");
+
+  // distributions in MeV
+  mt19937 gen(std::hash<string>()(fname));
+  uniform_real_distribution<float> u(0.,1.);
+  exponential_distribution<float> bkg_m(1./30e3), pT_dist(1./40e3),
+                                  jet_pT(1./40e3);
+  normal_distribution<float> sig_m(125e3,1.7e3), y_dist(0.,1.2),
+                             w_dist(1.,0.3), dy_dist(0.,2.5);
+  poisson_distribution<int> nj(mc ? 1.2 : 0.8);
+  lognormal_distribution<float> mjj_dist(std::log(300e3),0.8);
+
+  double n_all = 0;
+  for (Long64_t ent=0; ent<nevents; ++ent) {
+    isPassed = u(gen) < (mc ? 0.4 : 0.05);
+    weight = mc ? w_dist(gen) : 1.f;
+    n_all += weight;
+    cs_br_fe = 0.11; // cross section x BR x filter efficiency in pb
+    m_yy = mc && u(gen) < 0.9 ? sig_m(gen) : 80e3 + bkg_m(gen);
+    pT_yy = pT_dist(gen);
+    yAbs_yy = std::fabs(y_dist(gen));
+    cosTS_yy = 2*u(gen)-1;
+    N_j_30 = nj(gen);
+    N_j_50 = 0;
+    for (int j=0; j<N_j_30; ++j) N_j_50 += u(gen) < 0.4;
+    pT_j1 = N_j_30 ? 30e3 + jet_pT(gen) : -99e3;
+    if (N_j_30 >= 2) {
+      m_jj = mjj_dist(gen);
+      Dphi_j_j = M_PI*(2*u(gen)-1);
+      Dy_j_j = std::fabs(dy_dist(gen));
+    } else {
+      m_jj = -99e3;
+      Dphi_j_j = -99;
+      Dy_j_j = -99;
+    }
+    tree->Fill();
+  }
+
+  if (mc) {
+    TH1D *h = new TH1D("CutFlow_synthetic_noDalitz_weighted","",5,0,5);
+    h->SetBinContent(3,n_all);
+    h->GetXaxis()->SetBinLabel(3,"xAOD");
+  }
+
+  file->Write();
+  file->Close();
+  cout << fname << ": " << nevents << (mc ? " MC" : " data")
+       << " events" << endl;
+}
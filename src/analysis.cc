@@ -0,0 +1,664 @@
+#include "analysis.hh"
+
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include <TFile.h>
+#include <TH1.h>
+#include <TH2.h>
+#include <TH3.h>
+#include <TAxis.h>
+
+#include "rebin.hh"
+#include "checkpoint.hh"
+
+lumi_t lumi;
+bootstrap_t bootstrap;
+window_set windows;
+
+static bool ends_with(const string& str, const char* end) {
+  const size_t n = strlen(end);
+  return str.size() >= n && str.compare(str.size()-n,n,end)==0;
+}
+
+// Branches of the leading jet are undefined for N_j_30 == 0,
+// and branches of the two leading jets for N_j_30 < 2.
+// The first bin of a variable that reads them is reported as a jet
+// multiplicity category: 1 for N_j_30 == 0, 2 for N_j_30 < 2,
+// 0 for other branches.
+int jet_category(const string& branch) {
+  if ( ends_with(branch,"_j_j") || ends_with(branch,"_jj") ) return 2;
+  if ( ends_with(branch,"_j1") ) return 1;
+  return 0;
+}
+
+// Significance in bin of variable i, as written to the output
+double bin_signif(const var_set& vars, size_t i, unsigned bin,
+                  const result& r) {
+  if (bin==1) switch (vars[i].jets) {
+    case 1: return r.signif(r.nj0);
+    case 2: return r.signif(r.njless2);
+  }
+  return r.signif(vars.bank.bin_offset(i)+bin);
+}
+
+// Quadrature sum of bin significances of variable i
+double combined_signif(const var_set& vars, size_t i, const result& r) {
+  double z2 = 0;
+  for (unsigned bin=1, n=vars.bank.nbins(i); bin<=n; ++bin) {
+    const double z = bin_signif(vars,i,bin,r);
+    z2 += z*z;
+  }
+  return sqrt(z2);
+}
+
+// Union of the edges of both binnings of every variable,
+// so that both can be read out from the same fine bins
+var_set merge_edges(const var_set& a, const var_set& b) {
+  var_set out;
+  vector<bool> used(b.size(),false);
+  for (size_t i=0; i<a.size(); ++i) {
+    const float *e = a.bank.edges(i);
+    vector<float> edges(e, e+a.bank.nedges(i));
+    for (size_t k=0; k<b.size(); ++k) {
+      if (b[k].name != a[i].name) continue;
+      e = b.bank.edges(k);
+      edges.insert(edges.end(), e, e+b.bank.nedges(k));
+      used[k] = true;
+    }
+    sort(edges.begin(),edges.end());
+    edges.erase(unique(edges.begin(),edges.end()),edges.end());
+    out.add(a[i].def,edges.begin(),edges.end());
+  }
+  for (size_t k=0; k<b.size(); ++k) if (!used[k]) {
+    const float *e = b.bank.edges(k);
+    out.add(b[k].def, e, e+b.bank.nedges(k));
+  }
+  return out;
+}
+
+// Fine binning for the optimizer: every interval between finite edges
+// is split into n equal bins. Integer variables and the first bin of
+// jet variables are not split.
+var_set refine(const var_set& vars, unsigned n) {
+  var_set fine;
+  for (size_t i=0; i<vars.size(); ++i) {
+    const var& v = vars[i];
+    const float *e = vars.bank.edges(i);
+    const unsigned ne = vars.bank.nedges(i);
+    vector<float> edges;
+    for (unsigned j=0; j+1<ne; ++j) {
+      edges.push_back(e[j]);
+      if ( v.is_int() || std::isinf(e[j]) || std::isinf(e[j+1])
+        || (j==0 && v.jets) ) continue;
+      for (unsigned k=1; k<n; ++k)
+        edges.push_back(e[j] + double(e[j+1]-e[j])*k/n);
+    }
+    edges.push_back(e[ne-1]);
+    fine.add(v.def,edges.begin(),edges.end());
+  }
+  return fine;
+}
+
+// Merge fine bins to maximize the combined significance of every
+// variable, with at least smin signal and bmin sideband background
+// in each bin.
+var_set optimize(const var_set& fine, const result& r,
+                 double smin, double bmin) {
+  var_set opt;
+  for (size_t i=0; i<fine.size(); ++i) {
+    const string& name = fine[i].name;
+    const float *e = fine.bank.edges(i);
+    const unsigned n = fine.bank.nbins(i),
+                   off = fine.bank.bin_offset(i) + 1;
+    // first bin of jet variables is a category of its own
+    const unsigned first = fine[i].jets ? 1 : 0;
+
+    const vector<unsigned> bounds = optimal_merge(
+      r.bins.sig.data()+off+first, r.bins.bkg.data()+off+first, n-first,
+      smin, bmin, [&r](double s, double b){
+        const double z = signif(s,b,r.factor);
+        return z*z;
+      });
+
+    vector<float> edges(e, e+1+first);
+    if (bounds.empty()) {
+      cerr << "\033[33m" << name << ": no binning satisfies the minimum"
+              " signal and background\033[0m" << endl;
+      edges.push_back(e[n]);
+    } else {
+      for (size_t k=1; k<bounds.size(); ++k)
+        edges.push_back(e[first+bounds[k]]);
+    }
+    opt.add(fine[i].def,edges.begin(),edges.end());
+  }
+  return opt;
+}
+
+var_set read_bins(const string& fname) {
+  ifstream f(fname);
+  if (!f.is_open()) throw runtime_error("Unable to open "+fname);
+  var_set vars;
+  string line;
+  while ( getline(f,line) ) {
+    if (line.size()==0 || line[0]=='#') continue;
+    vars.add(line);
+  }
+  return vars;
+}
+
+// Edges for plotting: the overflow edge is made finite.
+// Variables are plotted in the units they are binned in, so e.g.
+// momenta are plotted in GeV if they are defined as pT_yy=pT_yy/1e3.
+void plot_edges(var_set& vars) {
+  for (size_t vi=0; vi<vars.size(); ++vi) {
+    float *edges = vars.bank.edges(vi);
+    const unsigned ne = vars.bank.nedges(vi);
+    if ( std::isinf(edges[ne-1]) ) {
+      edges[ne-1] = edges[ne-2] + (edges[1] - edges[0]);
+    }
+  }
+}
+
+// Bin labels of an integer variable binned by every value,
+// e.g. " = 0", " = 1", " #geq 2" for edges 0 1 2 inf;
+// none if the edges are not consecutive integers
+static vector<string> int_labels(const float* e, unsigned ne) {
+  vector<string> labels;
+  for (unsigned j=0; j+1<ne; ++j) {
+    const bool unit = e[j+1]==e[j]+1;
+    if ( e[j]!=std::floor(e[j])
+      || !(unit || (j+2==ne && std::isinf(e[j+1]))) ) return { };
+    ostringstream ss;
+    ss << (unit ? " = " : " #geq ") << e[j];
+    labels.push_back(ss.str());
+  }
+  return labels;
+}
+
+// Histograms of bin significances of every variable,
+// created in the current directory.
+// Edges are converted for plotting, so vars is taken by value.
+void write_hists(var_set vars, const result& r, bool print) {
+  vector<vector<string>> labels(vars.size());
+  for (size_t vi=0; vi<vars.size(); ++vi)
+    if (vars[vi].is_int())
+      labels[vi] = int_labels(vars.bank.edges(vi),vars.bank.nedges(vi));
+  plot_edges(vars);
+  for (size_t vi=0; vi<vars.size(); ++vi) {
+    const var& v = vars[vi];
+    const float *edges = vars.bank.edges(vi);
+    const unsigned ne = vars.bank.nedges(vi);
+
+    const unsigned n = vars.bank.nbins(vi);
+    const std::vector<double> hedges(edges,edges+ne);
+    TH1 *h = new TH1D(v.name.c_str(),"",n,hedges.data());
+
+    if (print) cout << v.name << endl;
+    unsigned bin = 1;
+    switch (v.jets) {
+      case 2:
+        h->SetBinContent(bin,r.signif(r.njless2));
+        h->SetBinError(bin++,r.signif_err(r.njless2));
+        break;
+      case 1:
+        h->SetBinContent(bin,r.signif(r.nj0));
+        h->SetBinError(bin++,r.signif_err(r.nj0));
+        break;
+    }
+
+    const unsigned off = vars.bank.bin_offset(vi);
+    const unsigned w = log10(edges[ne-1])+1;
+    for (; bin<=n; ++bin) {
+      double signif = r.signif(off+bin);
+      if (print)
+        cout <<'['<<setw(w)<< vars.bank.ledge(vi,bin)
+             <<','<<setw(w)<< vars.bank.redge(vi,bin) <<"): "
+             << r.bins.sig[off+bin] << "  "
+             << r.bins.bkg[off+bin] << "  "
+             << signif << endl;
+      h->SetBinContent(bin,signif);
+      h->SetBinError(bin,r.signif_err(off+bin));
+    }
+    if (print) cout << endl;
+
+    // other integer binnings are plotted with their edges
+    if (!labels[vi].empty()) {
+      TAxis *xa = h->GetXaxis();
+      for (unsigned i=0; i<n; ++i)
+        xa->SetBinLabel(i+1,labels[vi][i].c_str());
+      xa->SetLabelSize(0.05);
+    }
+  }
+
+  // products, with the edges converted above
+  const bin_bank<float>& bank = vars.bank;
+  for (unsigned p=0, np=bank.nproducts(); p<np; ++p) {
+    const string& name = vars.products[p];
+    const unsigned nd = bank.ndim(p), off = bank.product_offset(p);
+    vector<vector<double>> axes(nd);
+    vector<unsigned> n(nd);
+    for (unsigned a=0; a<nd; ++a) {
+      const unsigned vi = bank.axis(p,a);
+      const float *e = bank.edges(vi);
+      axes[a].assign(e, e+bank.nedges(vi));
+      n[a] = bank.nbins(vi);
+    }
+    TH1 *h = (nd==2)
+      ? static_cast<TH1*>(new TH2D(name.c_str(),"",
+          n[0],axes[0].data(), n[1],axes[1].data()))
+      : static_cast<TH1*>(new TH3D(name.c_str(),"",
+          n[0],axes[0].data(), n[1],axes[1].data(), n[2],axes[2].data()));
+
+    if (print) cout << name << endl;
+    double z2 = 0;
+    for (unsigned i=0, size=bank.product_size(p); i<size; ++i) {
+      unsigned b[3] = { 0, 0, 0 };
+      bool inside = true;
+      for (unsigned a=0; a<nd; ++a) {
+        b[a] = bank.axis_bin(p,a,i);
+        if (b[a]==0 || b[a]>n[a]) inside = false;
+      }
+      if (!inside) continue;
+
+      const double signif = r.signif(off+i);
+      z2 += signif*signif;
+      const int hbin = h->GetBin(b[0],b[1],b[2]);
+      h->SetBinContent(hbin,signif);
+      h->SetBinError(hbin,r.signif_err(off+i));
+      if (print) {
+        for (unsigned a=0; a<nd; ++a)
+          cout << (a ? " x [" : "[") << bank.ledge(bank.axis(p,a),b[a])
+               << ',' << bank.redge(bank.axis(p,a),b[a]) << ')';
+        cout << ": " << r.bins.sig[off+i] << "  "
+             << r.bins.bkg[off+i] << "  " << signif << endl;
+      }
+    }
+    if (print) cout << "Combined: " << sqrt(z2) << endl << endl;
+  }
+}
+
+// Distributions of bin significances over bootstrap replicas,
+// a 2D histogram per variable with its bins on x and significance on y
+void write_bootstrap(var_set vars, const vector<result>& reps) {
+  double zmax = 0;
+  for (const auto& r : reps)
+    for (size_t vi=0; vi<vars.size(); ++vi)
+      for (unsigned bin=1, n=vars.bank.nbins(vi); bin<=n; ++bin)
+        zmax = max(zmax,bin_signif(vars,vi,bin,r));
+  if (zmax==0) zmax = 1;
+
+  const unsigned nz = 100;
+  vector<double> zedges(nz+1);
+  for (unsigned j=0; j<=nz; ++j) zedges[j] = 1.05*zmax*j/nz;
+
+  var_set plot = vars;
+  plot_edges(plot);
+  for (size_t vi=0; vi<vars.size(); ++vi) {
+    const float *edges = plot.bank.edges(vi);
+    const unsigned n = vars.bank.nbins(vi);
+    const vector<double> hedges(edges,edges+n+1);
+    TH1 *h = new TH2D(vars[vi].name.c_str(),"",
+                      n,hedges.data(), nz,zedges.data());
+    for (const auto& r : reps)
+      for (unsigned bin=1; bin<=n; ++bin) {
+        const unsigned zb = min<unsigned>(
+          1 + bin_signif(vars,vi,bin,r)/zedges[nz]*nz, nz);
+        const int hb = h->GetBin(bin,zb);
+        h->SetBinContent(hb,h->GetBinContent(hb)+1);
+      }
+  }
+}
+
+// What the sums of an input file depend on,
+// for checkpoints and shards
+string sums_config(const var_set& vars) {
+  ostringstream ss;
+  ss.precision(9);
+  ss << "lumi.in " << lumi.in;
+  for (size_t i=0; i<vars.size(); ++i) {
+    ss << "; " << vars[i].def;
+    const float *e = vars.bank.edges(i);
+    for (unsigned j=0, ne=vars.bank.nedges(i); j<ne; ++j) ss << ' ' << e[j];
+  }
+  for (const auto& p : vars.products) ss << "; " << p;
+  for (unsigned w=0; w<windows.size(); ++w)
+    ss << "; window " << windows[w].signal.first << ' '
+       << windows[w].signal.second << ' ' << windows[w].range.first
+       << ' ' << windows[w].range.second;
+  if (bootstrap.n)
+    ss << "; bootstrap " << bootstrap.n << ' ' << bootstrap.seed;
+  return ss.str();
+}
+
+// Directory name of a window, in GeV, e.g. window_121_129_105_160
+string window_name(const window& w) {
+  ostringstream ss;
+  ss << "window_" << w.signal.first/1e3 << '_' << w.signal.second/1e3
+     << '_' << w.range.first/1e3 << '_' << w.range.second/1e3;
+  return ss.str();
+}
+
+void add_options(po::options_description& desc, settings& set) {
+  desc.add_options()
+    ("output,o", po::value(&set.ofname),
+     "output root file")
+    ("bins,b", po::value(&set.ifname_bins)->required(),
+     "differential variables bins")
+    ("candidates", po::value(&set.ifname_cands)->multitoken(),
+     "additional bins files, read out from the same pass")
+    ("bootstrap", po::value(&bootstrap.n)->default_value(0),
+     "number of Poisson bootstrap replicas of the first window")
+    ("bootstrap.seed", po::value(&bootstrap.seed)->default_value(0),
+     "seed of the bootstrap weights")
+    ("window", po::value(&set.window_strs)->multitoken(),
+     "signal window in GeV, lo:hi or lo:hi:range_lo:range_hi,\n"
+     "the rest of the range are the sidebands;\n"
+     "windows after the first are reported separately\n"
+     "[default: 121:129:105:160]")
+    ("lumi.in", po::value(&lumi.in)->default_value(3245.),
+     "configuration file")
+    ("lumi.need,l", po::value(&lumi.need)->default_value(6000.),
+     "configuration file")
+    ("profile", po::bool_switch(&set.prof_print),
+     "print time spent in every stage")
+    ("profile.json", po::value(&set.prof_json),
+     "write time spent in every stage to a json file")
+    ("optimize", po::value(&set.opt.nfine)->default_value(0),
+     "split bins into this many fine bins and merge them back\n"
+     "to maximize the combined significance")
+    ("opt.min-sig", po::value(&set.opt.min_sig)->default_value(1.),
+     "minimum signal in an optimized bin")
+    ("opt.min-bkg", po::value(&set.opt.min_bkg)->default_value(10.),
+     "minimum sideband background in an optimized bin")
+    ("opt.output", po::value(&set.opt.ofname),
+     "write optimized bins to this file")
+  ;
+}
+
+// Sets the windows and lumi.fac once the options are parsed
+void apply_options(const settings& set) {
+  vector<string> strs = set.window_strs;
+  if (strs.empty()) strs.emplace_back("121:129:105:160");
+  for (const auto& str : strs) {
+    vector<double> x;
+    for (size_t a=0, b; ; a=b+1) {
+      b = str.find(':',a);
+      x.push_back(1e3*stod(str.substr(a,b-a)));
+      if (b==string::npos) break;
+    }
+    if (x.size()==2) {
+      x.push_back(105e3);
+      x.push_back(160e3);
+    }
+    if (x.size()!=4) throw po::error("bad window "+str);
+    windows.add({x[0],x[1]},{x[2],x[3]});
+  }
+
+  lumi.fac = sqrt(lumi.need/lumi.in);
+}
+
+binnings read_binnings(const settings& set) {
+  binnings b;
+  b.vars = read_bins(set.ifname_bins);
+  for (const auto& f : set.ifname_cands) b.cands.push_back(read_bins(f));
+
+  if (b.vars.size()==0 || b.vars[b.vars.njets_i].name!="N_j_30")
+    throw runtime_error("N_j_30 branch was not used");
+  const int nj = b.vars.branch(b.vars.njets_i);
+  if (nj < 0 || !b.vars.branches[nj].is_int)
+    throw runtime_error("N_j_30 must be binned as the branch N_j_30:int");
+
+  if (set.opt.nfine || !b.cands.empty()) {
+    bool products = b.vars.bank.nproducts();
+    for (const auto& c : b.cands) products |= bool(c.bank.nproducts());
+    if (products)
+      throw runtime_error("products of variables cannot be used with"
+                          " --optimize or --candidates");
+  }
+
+  // Candidate variables named as variables of the bins file
+  // take their definitions from it
+  for (auto& c : b.cands) {
+    var_set d;
+    for (size_t i=0; i<c.size(); ++i) {
+      string def = c[i].def;
+      for (const auto& v : b.vars.vars) if (v.name==c[i].name) def = v.def;
+      const float *e = c.bank.edges(i);
+      d.add(def, e, e+c.bank.nedges(i));
+    }
+    c = d;
+  }
+
+  // The optimizer and the candidate binnings are read out from fine bins,
+  // which include the edges of all of them.
+  // The bins file binning is kept to compare with.
+  b.readout = set.opt.nfine || !b.cands.empty();
+  if (b.readout) {
+    b.vars_in = b.vars;
+    if (set.opt.nfine) b.vars = refine(b.vars_in,set.opt.nfine);
+    for (const auto& c : b.cands) b.vars = merge_edges(b.vars,c);
+  }
+  return b;
+}
+
+// Sums of input files, to be merged with signif-merge.
+// The configuration of the sums is stored and checked when reading,
+// so that sums of different binnings are not added.
+void write_shard(const string& fname, const string& config,
+                 const vector<input_file>& inputs, const vector<accum>& sums) {
+  ofstream f(fname, ios::binary);
+  f << "signif shard\n" << config << '\n' << inputs.size() << '\n';
+  for (size_t i=0; i<inputs.size(); ++i) {
+    f << inputs[i].name << '\n' << inputs[i].mc << '\n';
+    f.write(reinterpret_cast<const char*>(&inputs[i].n_all),sizeof(double));
+    write_arrays(f,sums[i].arrays());
+  }
+  if (!f) throw runtime_error("cannot write "+fname);
+}
+
+// Appends the input files of a shard and their sums
+void read_shard(const string& fname, const string& config,
+                const var_set& vars,
+                vector<input_file>& inputs, vector<accum>& sums) {
+  ifstream f(fname, ios::binary);
+  if (!f) throw runtime_error("cannot open "+fname);
+  string line;
+  if (!getline(f,line) || line!="signif shard")
+    throw runtime_error(fname+" is not a shard");
+  if (!getline(f,line) || line!=config)
+    throw runtime_error(fname+" was written with different bins,"
+                        " windows, lumi.in or bootstrap");
+  size_t n = 0;
+  if (getline(f,line)) n = stoul(line);
+  for (size_t i=0; i<n; ++i) {
+    string name, mc;
+    getline(f,name);
+    getline(f,mc);
+    for (const auto& in : inputs)
+      if (in.name==name)
+        throw runtime_error(name+" is in more than one shard");
+    inputs.emplace_back(name,mc=="1");
+    f.read(reinterpret_cast<char*>(&inputs.back().n_all),sizeof(double));
+    sums.emplace_back(vars);
+    if (!f || !read_arrays(f,sums.back().arrays()))
+      throw runtime_error("bad shard "+fname);
+  }
+}
+
+// Merges the sums of all input files, reads out the binnings,
+// prints the significances and writes the output file.
+// Returns the exit status.
+int finish(const settings& set, binnings bins,
+           const vector<input_file>& inputs, const vector<accum>& file_sums,
+           stage_time* prof) {
+  var_set &vars = bins.vars;
+  const var_set &vars_in = bins.vars_in;
+  const vector<var_set> &cands = bins.cands;
+  const bool readout = bins.readout;
+  const auto &opt = set.opt;
+
+  // the first window is the main one,
+  // the optimizer and the candidates use only its sums
+  vector<result> totals;
+  for (unsigned w=0; w<windows.size(); ++w)
+    totals.emplace_back(vars,windows[w].factor);
+  vector<result> replicas(bootstrap.n, result(vars,windows[0].factor));
+  {
+    scoped_timer tm(at(prof,stage::merge));
+    for (size_t f=0; f<inputs.size(); ++f) {
+      const input_file& input = inputs[f];
+      for (unsigned w=0; w<windows.size(); ++w)
+        totals[w].merge(file_sums[f], w, input.mc, input.n_all);
+      for (unsigned r=0; r<bootstrap.n; ++r)
+        replicas[r].merge_replica(file_sums[f], r, input.mc, input.n_all);
+    }
+  }
+  result& total = totals.front();
+
+  vector<cumulative_result> cums, boot_cums;
+  if (readout) {
+    scoped_timer tm(at(prof,stage::readout));
+    for (const auto& r : totals) cums.emplace_back(vars,r);
+    for (const auto& r : replicas) boot_cums.emplace_back(vars,r);
+  }
+
+  try {
+    scoped_timer tm(at(readout ? prof : nullptr, stage::readout));
+    if (opt.nfine) {
+      var_set vars_opt = optimize(vars, total, opt.min_sig, opt.min_bkg);
+      const result total_in = cums[0](vars_in);
+      total = cums[0](vars_opt);
+      vars = vars_opt;
+
+      unique_ptr<ofstream> optf;
+      if (!opt.ofname.empty()) optf.reset(new ofstream(opt.ofname));
+
+      cout << "============" << endl;
+      cout << "Optimized bins (combined significance: bins file -> optimized)"
+           << endl;
+      for (size_t i=0; i<vars.size(); ++i) {
+        ostringstream line;
+        line << vars[i].def;
+        const float *e = vars.bank.edges(i);
+        for (unsigned j=0, ne=vars.bank.nedges(i); j<ne; ++j)
+          line << ' ' << e[j];
+        cout << line.str() << endl
+             << "  " << combined_signif(vars_in,i,total_in)
+             << " -> " << combined_signif(vars,i,total) << endl;
+        if (optf) *optf << line.str() << '\n';
+      }
+    } else if (readout) {
+      total = cums[0](vars_in);
+      vars = vars_in;
+    }
+    if (readout) {
+      for (unsigned w=1; w<windows.size(); ++w) totals[w] = cums[w](vars);
+      for (unsigned r=0; r<bootstrap.n; ++r) replicas[r] = boot_cums[r](vars);
+    }
+  } catch (exception& e) {
+    cerr << "\033[31m" << e.what() <<"\033[0m"<< endl;
+    return 1;
+  }
+
+  // candidate binnings are read out after the main one,
+  // so that errors are reported before anything is written
+  vector<result> cand_totals;
+  try {
+    scoped_timer tm(at(readout ? prof : nullptr, stage::readout));
+    for (const auto& c : cands) cand_totals.push_back(cums[0](c));
+  } catch (exception& e) {
+    cerr << "\033[31m" << e.what() <<"\033[0m"<< endl;
+    return 1;
+  }
+
+  const bkg_sig &inclusive = total.inclusive;
+  const double factor = total.factor;
+
+  cout << "============" << endl;
+  test(factor)
+  cout << "Inclusive" << endl;
+  cout << "Signal: " << inclusive.sig << endl;
+  cout << "Bkg under signal: " << factor * inclusive.bkg << endl;
+  cout << "Bkg in sidebands: " << inclusive.bkg << endl;
+  cout << "Significance: " << total.signif(inclusive) << endl;
+  cout << "============" << endl;
+
+  if (windows.size() > 1) {
+    cout << "Windows (inclusive and combined significance)" << endl;
+    for (unsigned w=0; w<windows.size(); ++w) {
+      const result& r = totals[w];
+      cout << window_name(windows[w]) << ": "
+           << r.signif(r.inclusive) << endl;
+      for (size_t i=0; i<vars.size(); ++i)
+        cout << "  " << vars[i].name << ": "
+             << combined_signif(vars,i,r) << endl;
+    }
+    cout << "============" << endl;
+  }
+
+  if (bootstrap.n) {
+    cout << "Bootstrap (combined significance, mean and standard deviation"
+            " of " << bootstrap.n << " replicas)" << endl;
+    for (size_t i=0; i<vars.size(); ++i) {
+      double sum = 0, sum2 = 0;
+      for (const auto& r : replicas) {
+        const double z = combined_signif(vars,i,r);
+        sum += z;
+        sum2 += z*z;
+      }
+      const double mean = sum/bootstrap.n;
+      cout << "  " << vars[i].name << ": " << mean << " +- "
+           << sqrt(max(sum2/bootstrap.n - mean*mean, 0.)) << endl;
+    }
+    cout << "============" << endl;
+  }
+
+  {
+    scoped_timer tm(at(prof,stage::write));
+    TFile* file = new TFile(set.ofname.c_str(),"recreate");
+
+    write_hists(vars,total,true);
+
+    // every candidate goes into a directory named after its bins file
+    for (size_t c=0; c<cands.size(); ++c) {
+      string name = set.ifname_cands[c];
+      name = name.substr(name.rfind('/')+1);
+      name = name.substr(0,name.rfind('.'));
+      cout << "Candidate " << set.ifname_cands[c]
+           << " (combined significance)" << endl;
+      for (size_t i=0; i<cands[c].size(); ++i)
+        cout << "  " << cands[c][i].name << ": "
+             << combined_signif(cands[c],i,cand_totals[c]) << endl;
+      file->mkdir(name.c_str())->cd();
+      write_hists(cands[c],cand_totals[c],false);
+      file->cd();
+    }
+
+    if (bootstrap.n) {
+      file->mkdir("bootstrap")->cd();
+      write_bootstrap(vars,replicas);
+      file->cd();
+    }
+
+    // with several windows, every one goes into a directory of its own
+    if (windows.size() > 1)
+      for (unsigned w=0; w<windows.size(); ++w) {
+        file->mkdir(window_name(windows[w]).c_str())->cd();
+        write_hists(vars,totals[w],false);
+        file->cd();
+      }
+
+    file->Write();
+    file->Close();
+    delete file;
+  }
+
+  return 0;
+}
@@ -0,0 +1,534 @@
+#ifndef signif_analysis_hh
+#define signif_analysis_hh
+
+/*
+ * Binnings, sums and output of signif, shared by signif and signif-merge.
+ * The global settings are defined in analysis.cc.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <utility>
+#include <cmath>
+#include <cctype>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/program_options.hpp>
+
+#include <Rtypes.h>
+
+#include "bin_bank.hh"
+#include "bin_index.hh"
+#include "in.hh"
+#include "cumulative.hh"
+#include "stage_profile.hh"
+#include "expr.hh"
+
+using namespace std;
+namespace po = boost::program_options;
+
+#define test(var) \
+  std::cout <<"\033[36m"<< #var <<"\033[0m"<< " = " << var << std::endl;
+
+constexpr double len(pair<double,double> p) {
+  return p.second - p.first;
+}
+template <typename T1, typename T2, typename T3>
+inline bool in(T1 x, const pair<T2,T3>& p) noexcept {
+  return (p.first < x && x < p.second);
+}
+
+extern struct lumi_t { double in, need, fac; } lumi;
+
+// number of bootstrap replicas of the first window and their seed
+extern struct bootstrap_t { unsigned n; uint64_t seed; } bootstrap;
+
+// Profiled stages. Every thread has a row of stage_time,
+// which is null when profiling is disabled.
+// wait is the time a reader is blocked on its filling thread.
+namespace stage {
+enum { open, cutflow, read, select, wait, fill, merge, readout, write, n };
+const vector<string> names {
+  "open", "cutflow", "read", "select", "wait", "fill", "merge", "readout",
+  "write"
+};
+}
+
+inline stage_time* at(stage_time* prof, unsigned s) noexcept {
+  return prof ? prof+s : nullptr;
+}
+
+// factor is the ratio of background under the signal
+// to background in the sidebands
+inline double signif(double sig, double bkg, double factor) noexcept {
+  return sig!=0 ? lumi.fac * sig / sqrt(sig + factor * bkg) : 0;
+}
+
+// Uncertainty of signif() from the sums of squared weights,
+// with signal and background independent
+inline double signif_err(double sig, double bkg, double sig2, double bkg2,
+                         double factor) noexcept {
+  if (sig==0) return 0;
+  const double d = sig + factor * bkg,
+               c = lumi.fac / (2 * d * sqrt(d)),
+               ds = c * (sig + 2 * factor * bkg),
+               db = c * factor * sig;
+  return sqrt(ds*ds*sig2 + db*db*bkg2);
+}
+
+// Signal window in a range of diphoton mass, in MeV.
+// The rest of the range are the sidebands.
+struct window {
+  pair<double,double> signal, range;
+  double factor;
+};
+
+// Data contributes background from the sidebands,
+// MC contributes signal from the mass window.
+enum class sample { data, mc };
+
+template <sample S> inline bool counts(double m, const window& w) noexcept;
+template <>
+inline bool counts<sample::data>(double m, const window& w) noexcept {
+  return in(m,w.range) && !in(m,w.signal);
+}
+template <>
+inline bool counts<sample::mc>(double m, const window& w) noexcept {
+  return in(m,w.signal);
+}
+
+// Windows filled from the same pass over the events.
+// Bit w of mask<S>(m) is set if an event counts for window w.
+class window_set {
+  vector<window> ws;
+  pair<double,double> hull;
+
+public:
+  void add(pair<double,double> signal, pair<double,double> range) {
+    if (!(range.first <= signal.first && signal.first < signal.second &&
+          signal.second <= range.second) || len(signal)==len(range))
+      throw runtime_error("signal window must be inside its mass range"
+                          " and leave some sidebands");
+    if (ws.size()==32) throw runtime_error("too many mass windows");
+    ws.push_back({signal,range,len(signal)/(len(range)-len(signal))});
+    if (ws.size()==1) hull = range;
+    else {
+      hull.first  = min(hull.first, range.first );
+      hull.second = max(hull.second,range.second);
+    }
+  }
+
+  inline unsigned size() const noexcept { return ws.size(); }
+  inline const window& operator[](unsigned i) const noexcept { return ws[i]; }
+
+  // union of the mass ranges of all windows
+  inline const pair<double,double>& range() const noexcept { return hull; }
+
+  template <sample S>
+  inline unsigned mask(double m) const noexcept {
+    unsigned k = 0;
+    for (unsigned w=0; w<ws.size(); ++w)
+      k |= unsigned(counts<S>(m,ws[w])) << w;
+    return k;
+  }
+};
+extern window_set windows;
+
+// Sums of weights and of squared weights
+struct bkg_sig {
+  double bkg, sig, bkg2, sig2;
+  bkg_sig(): bkg(0), sig(0), bkg2(0), sig2(0) { }
+};
+
+// bkg_sig for every bin of a bin_bank, one array per sum
+struct bkg_sig_bank {
+  vector<double> bkg, sig, bkg2, sig2;
+  bkg_sig_bank(unsigned n): bkg(n,0.), sig(n,0.), bkg2(n,0.), sig2(n,0.) { }
+};
+
+typedef expr_value var_value;
+static_assert(sizeof(Float_t)==sizeof(float) && sizeof(Int_t)==sizeof(int32_t),
+  "branch values must be 32 bit");
+
+// Jet multiplicity category of a branch, see analysis.cc
+int jet_category(const string& branch);
+
+// A variable is defined in the bins file as [name=]expression,
+// e.g. N_j_30:int, Dphi_j_j=abs(Dphi_j_j) or pT_yy/m_yy.
+// The name is also the name of its histograms, so it may only have
+// letters, digits and underscores. Without a name, it is made from the
+// expression without branch types, with every run of other characters
+// replaced by an underscore, e.g. pT_yy_m_yy.
+struct var {
+  string name, def;
+  expr x;
+  int jets; // highest jet_category() of the branches it reads
+
+  var(const string& def, vector<expr_branch>& branches)
+  : name(var_name(def)), def(def),
+    x(def.substr(def.find('=')+1), branches), jets(0) {
+    for (unsigned b : x.reads())
+      jets = max(jets,jet_category(branches[b].name));
+  }
+
+  inline bool is_int() const noexcept { return x.is_int(); }
+
+  static bool name_char(char c) {
+    return isalnum((unsigned char)c) || c=='_';
+  }
+
+  static string var_name(const string& def) {
+    const size_t eq = def.find('=');
+    if (eq!=string::npos) {
+      const string name = def.substr(0,eq);
+      if (name.empty() || !all_of(name.begin(),name.end(),name_char))
+        throw runtime_error("bad variable name \""+name+"\" in "+def);
+      return name;
+    }
+    string name;
+    bool sep = false;
+    for (size_t i=0; i<def.size(); ++i) {
+      if (def[i]==':') {
+        while (i+1<def.size() && isalpha(def[i+1])) ++i;
+      } else if (name_char(def[i])) {
+        if (sep && !name.empty()) name += '_';
+        name += def[i];
+        sep = false;
+      } else sep = true;
+    }
+    return name;
+  }
+};
+
+// Binned variables, with edges of all of them in one bin_bank.
+// Variable i is binning i of the bank, product p of variables
+// is product p of the bank.
+// Variables are computed from columns of the branches they read,
+// which are listed once in branches.
+struct var_set {
+  bin_bank<float> bank;
+  vector<var> vars;
+  vector<string> products;
+  vector<expr_branch> branches;
+  size_t njets_i;
+  unsigned stack_size; // columns for evaluating any of the expressions
+
+  var_set(): njets_i(0), stack_size(1) { }
+
+  // Names identify variables in the output and between binnings,
+  // so two variables cannot have the same name
+  template <typename InputIterator>
+  void add(const string& def, InputIterator first, InputIterator last) {
+    const string name = var::var_name(def);
+    for (const auto& v : vars)
+      if (v.name==name)
+        throw runtime_error("variables "+v.def+" and "+def+" have the"
+                            " same name "+name+"; name them as name=expr");
+    vars.emplace_back(def,branches);
+    bank.add(first,last);
+    if (vars.back().name=="N_j_30") njets_i = vars.size()-1;
+    stack_size = max(stack_size,vars.back().x.stack_size());
+  }
+
+  void add(const string& str) {
+    vector<string> tok;
+    bool space = true;
+    for (char c : str) {
+      if (c==' ' || c==',') {
+        space = true;
+      } else if (space) {
+        tok.emplace_back(1,c);
+        space = false;
+      } else tok.back() += c;
+    }
+    // product of variables defined above, e.g. pT_yy x N_j_30
+    if (tok.size()>2 && tok[1]=="x") {
+      vector<unsigned> axes;
+      string name;
+      for (size_t j=0; j<tok.size(); j+=2) {
+        if (j && tok[j-1]!="x")
+          throw runtime_error("bad product of variables: "+str);
+        axes.push_back(index(tok[j]));
+        name += (j ? "_x_" : "") + tok[j];
+      }
+      if (axes.size()>3)
+        throw runtime_error("more than 3 variables in product: "+str);
+      if (count(products.begin(),products.end(),name)
+          || any_of(vars.begin(),vars.end(),
+                    [&](const var& v){ return v.name==name; }))
+        throw runtime_error("product "+str+" has the same name as"
+                            " another variable or product");
+      products.push_back(name);
+      bank.add_product(axes.begin(),axes.end());
+      return;
+    }
+    vector<double> edges(tok.size()-1);
+    for (unsigned i=1; i<tok.size(); ++i)
+      edges[i-1] = std::stod(tok[i]);
+    add(tok.front(),edges.begin(),edges.end());
+  }
+
+  inline size_t size() const noexcept { return vars.size(); }
+  inline const var& operator[](size_t i) const noexcept { return vars[i]; }
+
+  size_t index(const string& name) const {
+    for (size_t i=0; i<vars.size(); ++i)
+      if (vars[i].name==name) return i;
+    throw runtime_error("variable "+name+" must be binned before"
+                        " it is used in a product");
+  }
+
+  // Index of the branch of variable i, if it is only a branch; -1 otherwise
+  int branch(size_t i) const noexcept {
+    bool take_abs;
+    const int b = vars[i].x.branch(take_abs);
+    return take_abs ? -1 : b;
+  }
+
+  // Local bin indices of variable i for columns of raw branch values.
+  // A branch, or abs() of one, is binned directly, with the conversion
+  // from int and abs() done inside the SIMD bin index kernel.
+  // Other expressions are evaluated into buf first, which has room
+  // for stack_size*n values.
+  // The kernel is linear in the number of edges, so fine binnings with
+  // more than bin_index_max_edges are binned by binary search.
+  void find_bins(size_t i, const var_value* const* cols, unsigned* idx,
+                 unsigned n, float* buf) const noexcept {
+    const float *e = bank.edges(i);
+    const unsigned ne = bank.nedges(i);
+    const bool search = ne > bin_index_max_edges;
+    const expr& x = vars[i].x;
+    bool take_abs;
+    const int b = x.branch(take_abs);
+    if (b < 0 || search) {
+      x(cols, buf, n, buf+n);
+      if (search)
+        for (unsigned k=0; k<n; ++k) idx[k] = bank.find_bin(i,buf[k]);
+      else bin_index<false>(e, ne, buf, idx, n);
+    } else if (branches[b].is_int) {
+      if (take_abs) bin_index<true >(e, ne, &cols[b]->i, idx, n);
+      else          bin_index<false>(e, ne, &cols[b]->i, idx, n);
+    } else {
+      if (take_abs) bin_index<true >(e, ne, &cols[b]->f, idx, n);
+      else          bin_index<false>(e, ne, &cols[b]->f, idx, n);
+    }
+  }
+};
+
+// Accumulators filled from a single task.
+// Each task gets its own copy, so nothing is shared between threads.
+// A task reads either data or MC, so only one lane of sums is needed:
+// windows.mask<S>() selects the events, and merge() adds the lane to
+// bkg or sig of the result.
+// Every bin has the sums of weights and of squared weights of every
+// window next to each other, so all of them are filled with one
+// contiguous add per event.
+// Bootstrap replicas of the first window are kept the same way,
+// all replicas of a bin next to each other.
+struct accum {
+  static unsigned stride() noexcept { return 2*windows.size(); }
+  vector<double> inclusive, nj0, njless2, bins;
+  vector<double> boot_inclusive, boot_nj0, boot_njless2, boot_bins;
+
+  accum(const var_set& vars)
+  : inclusive(stride(),0.), nj0(stride(),0.), njless2(stride(),0.),
+    bins(vars.bank.nbins_total()*stride(),0.),
+    boot_inclusive(bootstrap.n,0.), boot_nj0(bootstrap.n,0.),
+    boot_njless2(bootstrap.n,0.),
+    boot_bins(vars.bank.nbins_total()*bootstrap.n,0.) { }
+
+  // all sums, for checkpoints
+  vector<vector<double>*> arrays() {
+    return { &inclusive, &nj0, &njless2, &bins,
+             &boot_inclusive, &boot_nj0, &boot_njless2, &boot_bins };
+  }
+  vector<const vector<double>*> arrays() const {
+    return { &inclusive, &nj0, &njless2, &bins,
+             &boot_inclusive, &boot_nj0, &boot_njless2, &boot_bins };
+  }
+
+  accum& operator+=(const accum& o) {
+    const auto a = arrays();
+    const auto b = o.arrays();
+    for (size_t i=0; i<a.size(); ++i)
+      for (size_t j=0; j<a[i]->size(); ++j) (*a[i])[j] += (*b[i])[j];
+    return *this;
+  }
+};
+
+// Sums of one window
+struct result {
+  bkg_sig inclusive, nj0, njless2;
+  bkg_sig_bank bins;
+  double factor;
+
+  result(const var_set& vars, double factor)
+  : bins(vars.bank.nbins_total()), factor(factor) { }
+
+  inline double signif(const bkg_sig& x) const noexcept {
+    return ::signif(x.sig,x.bkg,factor);
+  }
+  inline double signif(unsigned i) const noexcept {
+    return ::signif(bins.sig[i],bins.bkg[i],factor);
+  }
+  inline double signif_err(const bkg_sig& x) const noexcept {
+    return ::signif_err(x.sig,x.bkg,x.sig2,x.bkg2,factor);
+  }
+  inline double signif_err(unsigned i) const noexcept {
+    return ::signif_err(bins.sig[i],bins.bkg[i],
+                        bins.sig2[i],bins.bkg2[i],factor);
+  }
+
+  void merge(const accum& a, unsigned w, bool mc, double n) noexcept {
+    const unsigned stride = accum::stride();
+    w *= 2;
+    const double n2 = n*n;
+    double bkg_sig::*lane  = mc ? &bkg_sig::sig  : &bkg_sig::bkg;
+    double bkg_sig::*lane2 = mc ? &bkg_sig::sig2 : &bkg_sig::bkg2;
+    inclusive.*lane  += a.inclusive[w]/n;
+    inclusive.*lane2 += a.inclusive[w+1]/n2;
+    nj0.*lane  += a.nj0[w]/n;
+    nj0.*lane2 += a.nj0[w+1]/n2;
+    njless2.*lane  += a.njless2[w]/n;
+    njless2.*lane2 += a.njless2[w+1]/n2;
+    vector<double>& out  = mc ? bins.sig  : bins.bkg;
+    vector<double>& out2 = mc ? bins.sig2 : bins.bkg2;
+    for (size_t i=0; i<out.size(); ++i) {
+      out [i] += a.bins[i*stride+w  ]/n;
+      out2[i] += a.bins[i*stride+w+1]/n2;
+    }
+  }
+
+  // sums of bootstrap replica r, without the squared weights
+  void merge_replica(const accum& a, unsigned r, bool mc, double n) noexcept {
+    const unsigned nb = bootstrap.n;
+    double bkg_sig::*lane = mc ? &bkg_sig::sig : &bkg_sig::bkg;
+    inclusive.*lane += a.boot_inclusive[r]/n;
+    nj0.*lane += a.boot_nj0[r]/n;
+    njless2.*lane += a.boot_njless2[r]/n;
+    vector<double>& out = mc ? bins.sig : bins.bkg;
+    for (size_t i=0; i<out.size(); ++i) out[i] += a.boot_bins[i*nb+r]/n;
+  }
+};
+
+double bin_signif(const var_set& vars, size_t i, unsigned bin,
+                  const result& r);
+double combined_signif(const var_set& vars, size_t i, const result& r);
+
+// Running sums of the fine bins of every variable.
+// Sums for any binning whose edges are a subset of the fine edges
+// are read out with two lookups per bin, so many candidate binnings
+// can be evaluated from a single pass over the events.
+class cumulative_result {
+  bkg_sig inclusive, nj0, njless2;
+  double factor;
+  vector<string> names;
+  vector<cumulative<float>> bkg, sig, bkg2, sig2;
+
+  size_t index(const string& name) const {
+    for (size_t i=0; i<names.size(); ++i)
+      if (names[i]==name) return i;
+    throw runtime_error("variable "+name+" was not filled");
+  }
+
+public:
+  cumulative_result(const var_set& fine, const result& r)
+  : inclusive(r.inclusive), nj0(r.nj0), njless2(r.njless2),
+    factor(r.factor) {
+    for (size_t i=0; i<fine.size(); ++i) {
+      const float *e = fine.bank.edges(i);
+      const unsigned ne = fine.bank.nedges(i),
+                     off = fine.bank.bin_offset(i);
+      names.push_back(fine[i].name);
+      bkg.emplace_back(e, ne, r.bins.bkg.data()+off);
+      sig.emplace_back(e, ne, r.bins.sig.data()+off);
+      bkg2.emplace_back(e, ne, r.bins.bkg2.data()+off);
+      sig2.emplace_back(e, ne, r.bins.sig2.data()+off);
+    }
+  }
+
+  result operator()(const var_set& coarse) const {
+    result out(coarse,factor);
+    out.inclusive = inclusive;
+    out.nj0 = nj0;
+    out.njless2 = njless2;
+    for (size_t i=0; i<coarse.size(); ++i) {
+      const size_t fi = index(coarse[i].name);
+      const float *e = coarse.bank.edges(i);
+      for (unsigned j=0, ne=coarse.bank.nedges(i); j<ne; ++j)
+        if (!bkg[fi].has_edge(e[j])) {
+          ostringstream ss;
+          ss << coarse[i].name << ": " << e[j] << " is not a fine edge";
+          throw runtime_error(ss.str());
+        }
+      const unsigned off = coarse.bank.bin_offset(i);
+      for (unsigned j=0, n=coarse.bank.nbins(i)+2; j<n; ++j) {
+        const float a = coarse.bank.ledge(i,j), b = coarse.bank.redge(i,j);
+        out.bins.bkg[off+j] = bkg[fi].sum(a,b);
+        out.bins.sig[off+j] = sig[fi].sum(a,b);
+        out.bins.bkg2[off+j] = bkg2[fi].sum(a,b);
+        out.bins.sig2[off+j] = sig2[fi].sum(a,b);
+      }
+    }
+    return out;
+  }
+};
+
+var_set merge_edges(const var_set& a, const var_set& b);
+var_set refine(const var_set& vars, unsigned n);
+var_set optimize(const var_set& fine, const result& r,
+                 double smin, double bmin);
+var_set read_bins(const string& fname);
+
+struct input_file {
+  string name;
+  bool mc;
+  double n_all;
+  input_file(const string& name, bool mc): name(name), mc(mc), n_all(1) { }
+};
+
+// Output, created in the current directory of ROOT
+void plot_edges(var_set& vars);
+void write_hists(var_set vars, const result& r, bool print);
+void write_bootstrap(var_set vars, const vector<result>& reps);
+
+string sums_config(const var_set& vars);
+string window_name(const window& w);
+
+// Options of the binnings, the sums and the output,
+// common to signif and signif-merge
+struct settings {
+  string ofname, ifname_bins;
+  vector<string> ifname_cands, window_strs;
+  struct { unsigned nfine; double min_sig, min_bkg; string ofname; } opt;
+  bool prof_print;
+  string prof_json;
+};
+
+void add_options(po::options_description& desc, settings& set);
+void apply_options(const settings& set);
+
+// Binning of the sums, and the binnings read out from it
+struct binnings {
+  var_set vars, vars_in; // vars_in is the bins file binning
+  vector<var_set> cands;
+  bool readout;
+};
+
+binnings read_binnings(const settings& set);
+
+void write_shard(const string& fname, const string& config,
+                 const vector<input_file>& inputs, const vector<accum>& sums);
+void read_shard(const string& fname, const string& config,
+                const var_set& vars,
+                vector<input_file>& inputs, vector<accum>& sums);
+
+int finish(const settings& set, binnings bins,
+           const vector<input_file>& inputs, const vector<accum>& file_sums,
+           stage_time* prof);
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef snip_bin_bank_hh
+#define snip_bin_bank_hh
+
+#include <vector>
+#include <limits>
+
+/*
+ * Edges of many binnings in one contiguous array.
+ *
+ * Binning i has nedges(i) edges and nedges(i)+1 bins,
+ * including underflow and overflow, same convention as in binner.
+ * Bins of all binnings are numbered consecutively, so accumulators for
+ * all of them can be kept in flat arrays of nbins_total() elements,
+ * with bins of binning i starting at bin_offset(i).
+ *
+ * Products of binnings are multi-dimensional binnings over existing
+ * ones, numbered separately. Their bins follow all the one-dimensional
+ * bins, with product p starting at product_offset(p).
+ * Bins of a product are flattened with the last axis varying fastest,
+ * including underflow and overflow on every axis, and strides are
+ * precomputed when the product is added.
+ */
+
+template <typename Edge = double>
+class bin_bank {
+public:
+  typedef Edge edge_t;
+  typedef unsigned size_type;
+
+protected:
+  std::vector<edge_t> _edges;
+  std::vector<size_type> _edge_offsets, _bin_offsets;
+  std::vector<size_type> _axes, _strides, _axis_offsets, _prod_offsets;
+
+public:
+  bin_bank()
+  : _edge_offsets(1,0), _bin_offsets(1,0),
+    _axis_offsets(1,0), _prod_offsets(1,0) { }
+
+  // returns index of the added binning
+  template <typename InputIterator>
+  size_type add(InputIterator first, InputIterator last) {
+    _edges.insert(_edges.end(), first, last);
+    const size_type ne = _edges.size() - _edge_offsets.back();
+    _edge_offsets.push_back(_edges.size());
+    _bin_offsets.push_back(_bin_offsets.back() + ne + 1);
+    return size()-1;
+  }
+
+  // Product of existing binnings, given by their indices.
+  // Returns index of the added product.
+  template <typename InputIterator>
+  size_type add_product(InputIterator first, InputIterator last) {
+    const size_type a0 = _axes.size();
+    _axes.insert(_axes.end(), first, last);
+    const size_type na = _axes.size() - a0;
+    _strides.resize(_axes.size());
+    size_type n = 1;
+    for (size_type a=na; a--; ) {
+      _strides[a0+a] = n;
+      n *= nedges(_axes[a0+a])+1;
+    }
+    _axis_offsets.push_back(_axes.size());
+    _prod_offsets.push_back(_prod_offsets.back() + n);
+    return nproducts()-1;
+  }
+
+  //---------------------------------------------
+
+  inline size_type size() const noexcept { return _edge_offsets.size()-1; }
+
+  inline size_type nedges(size_type i) const noexcept {
+    return _edge_offsets[i+1] - _edge_offsets[i];
+  }
+  inline const edge_t* edges(size_type i) const noexcept {
+    return _edges.data() + _edge_offsets[i];
+  }
+  inline edge_t* edges(size_type i) noexcept {
+    return _edges.data() + _edge_offsets[i];
+  }
+
+  // number of bins excluding underflow and overflow
+  inline size_type nbins(size_type i) const noexcept {
+    return nedges(i)-1;
+  }
+
+  inline size_type bin_offset(size_type i) const noexcept {
+    return _bin_offsets[i];
+  }
+  // number of bins of all binnings and products
+  inline size_type nbins_total() const noexcept {
+    return _bin_offsets.back() + _prod_offsets.back();
+  }
+
+  //---------------------------------------------
+
+  inline size_type nproducts() const noexcept {
+    return _prod_offsets.size()-1;
+  }
+  inline size_type ndim(size_type p) const noexcept {
+    return _axis_offsets[p+1] - _axis_offsets[p];
+  }
+  // binning index of axis a of product p
+  inline size_type axis(size_type p, size_type a) const noexcept {
+    return _axes[_axis_offsets[p]+a];
+  }
+  inline size_type stride(size_type p, size_type a) const noexcept {
+    return _strides[_axis_offsets[p]+a];
+  }
+  inline size_type product_offset(size_type p) const noexcept {
+    return _bin_offsets.back() + _prod_offsets[p];
+  }
+  // number of bins of product p, including underflow and overflow
+  inline size_type product_size(size_type p) const noexcept {
+    return _prod_offsets[p+1] - _prod_offsets[p];
+  }
+  // bin index on axis a of local bin i of product p
+  inline size_type axis_bin(size_type p, size_type a, size_type i)
+  const noexcept {
+    return (i / stride(p,a)) % (nedges(axis(p,a))+1);
+  }
+
+  //---------------------------------------------
+
+  // Local bin index in binning i.
+  // Branch-free binary search, as binner::find_bin_search.
+  size_type find_bin(size_type i, edge_t e) const noexcept {
+    const edge_t *first = edges(i), *base = first;
+    size_type n = nedges(i);
+    if (n==0) return 0;
+    while (n > 1) {
+      const size_type half = n/2;
+      base = (base[half] <= e) ? base+half : base;
+      n -= half;
+    }
+    return (base - first) + (*base <= e);
+  }
+
+  edge_t ledge(size_type i, size_type bin) const noexcept {
+    return bin ? edges(i)[bin-1] : -std::numeric_limits<edge_t>::infinity();
+  }
+  edge_t redge(size_type i, size_type bin) const noexcept {
+    return bin<nedges(i) ? edges(i)[bin]
+                         : std::numeric_limits<edge_t>::infinity();
+  }
+};
+
+#endif
@@ -1,10 +1,12 @@
 #ifndef snip_binner_hh
 #define snip_binner_hh
 
+#include <vector>
 #include <limits>
 #include <utility>
 
 #include "type_traits_extra.hh"
+#include "bin_index.hh"
 
 /*
  * Same convention as in ROOT TH1:
@@ -70,25 +72,40 @@ protected:
   std::vector<edge_t> _edges;
   std::vector< bin_t> _bins;
 
+  // Uniform binning, set only by the (nbins, xlow, xup) constructor.
+  // Lets find_bin compute the index arithmetically.
+  // Edges are only read through edges(); assignment and init()
+  // replace them and clear the flag.
+  bool _uniform;
+  double _inv_step;
+
 public:
-  binner() { }
-  binner(const binner& o): _edges(o._edges), _bins(o._bins) { }
+  binner(): _uniform(false), _inv_step(0) { }
+  binner(const binner& o)
+  : _edges(o._edges), _bins(o._bins),
+    _uniform(o._uniform), _inv_step(o._inv_step) { }
   binner(binner&& o) noexcept
-  : _edges(std::move(o._edges)), _bins(std::move(o._bins)) { }
+  : _edges(std::move(o._edges)), _bins(std::move(o._bins)),
+    _uniform(o._uniform), _inv_step(o._inv_step) { }
 
   binner& operator=(const binner& o) {
     _edges = o._edges;
     _bins = o._bins;
+    _uniform = o._uniform;
+    _inv_step = o._inv_step;
     return *this;
   }
   binner& operator=(binner&& o) noexcept {
     _edges = std::move(o._edges);
     _bins = std::move(o._bins);
+    _uniform = o._uniform;
+    _inv_step = o._inv_step;
     return *this;
   }
 
   binner(size_type nbins, edge_t xlow, edge_t xup)
-  : _edges(nbins+1), _bins(nbins+2)
+  : _edges(nbins+1), _bins(nbins+2),
+    _uniform(nbins>0 && xlow<xup), _inv_step(double(nbins)/(xup-xlow))
   {
     const edge_t step = (xup-xlow)/nbins;
     for (size_type i=0; i<=nbins; ++i)
@@ -96,35 +113,39 @@ public:
   }
 
   binner(const std::vector<edge_t>& edges)
-  : _edges(edges), _bins(_edges.size()+1)
+  : _edges(edges), _bins(_edges.size()+1), _uniform(false), _inv_step(0)
   { }
   binner& operator=(const std::vector<edge_t>& edges) {
     _edges = edges;
     _bins = std::vector<bin_t>(_edges.size()+1);
+    _uniform = false;
     return *this;
   }
 
   binner(std::vector<edge_t>&& edges) noexcept
-  : _edges(std::move(edges)), _bins(_edges.size()+1)
+  : _edges(std::move(edges)), _bins(_edges.size()+1),
+    _uniform(false), _inv_step(0)
   { }
   binner& operator=(std::vector<edge_t>&& edges) noexcept {
     _edges = std::move(edges);
     _bins = std::vector<bin_t>(_edges.size()+1);
+    _uniform = false;
     return *this;
   }
 
   binner(std::initializer_list<edge_t> il)
-  : _edges(il), _bins(_edges.size()+1)
+  : _edges(il), _bins(_edges.size()+1), _uniform(false), _inv_step(0)
   { }
   binner& operator=(std::initializer_list<edge_t> il) {
     _edges = il;
     _bins = std::vector<bin_t>(_edges.size()+1);
+    _uniform = false;
     return *this;
   }
 
   template <typename InputIterator>
   binner(InputIterator first, InputIterator last)
-  : _edges(first,last), _bins(_edges.size()+1)
+  : _edges(first,last), _bins(_edges.size()+1), _uniform(false), _inv_step(0)
   { }
 
   template <typename InputIterator>
@@ -132,22 +153,47 @@ public:
   {
     _edges = {first,last};
     _bins = decltype(_bins)(_edges.size()+1);
+    _uniform = false;
   }
 
   //---------------------------------------------
 
-  size_type find_bin(edge_t e) noexcept {
-    size_type i = _edges.size()-1;
-    for (;;--i) {
-      if (e >= _edges[i]) {
-        ++i;
-        break;
-      }
-      if (i==0) break;
+  // Number of edges <= e, i.e. the bin index.
+  // Branch-free binary search: the loop trip count depends only on
+  // the number of edges, and the comparison compiles to a cmov.
+  size_type find_bin_search(edge_t e) const noexcept {
+    const edge_t *base = _edges.data();
+    size_type n = _edges.size();
+    if (n==0) return 0;
+    while (n > 1) {
+      const size_type half = n/2;
+      base = (base[half] <= e) ? base+half : base;
+      n -= half;
     }
-    return i;
+    return (base - _edges.data()) + (*base <= e);
+  }
+
+  // O(1) index for uniform bins.
+  // The index is clamped without branches and then corrected by one
+  // against the stored edges, so that it agrees with find_bin_search()
+  // for values on or next to an edge. NaN goes to the underflow bin.
+  size_type find_bin_uniform(edge_t e) const noexcept {
+    const size_type n = _edges.size()-1;
+    double u = (e-_edges.front())*_inv_step + 1.;
+    u = (u > 0.) ? u : 0.;
+    u = (u < n+1.) ? u : n+1.;
+    const size_type i = int(u);
+    const size_type lo = i ? i-1 : 0;
+    const size_type hi = i<=n ? i : n;
+    return i - ((i!=0) & (e < _edges[lo])) + ((i<=n) & (e >= _edges[hi]));
+  }
+
+  inline size_type find_bin(edge_t e) const noexcept {
+    return _uniform ? find_bin_uniform(e) : find_bin_search(e);
   }
 
+  inline bool uniform() const noexcept { return _uniform; }
+
   template <typename... TT>
   size_type fill(edge_t e, TT&&... args)
   noexcept(noexcept( filler_t()(std::declval<bin_t&>(),
@@ -168,6 +214,66 @@ public:
 
   //---------------------------------------------
 
+  // Bin indices for a block of values.
+  // The lookup is hoisted out of the loop, so that each pass is a
+  // straight loop over x that the compiler can vectorize.
+  // For float edges the SIMD compare-and-count kernel is used,
+  // unless there are too many edges.
+  void find_bins(const edge_t* x, size_type* idx, size_type n)
+  const noexcept {
+    if (_uniform)
+      for (size_type k=0; k<n; ++k) idx[k] = find_bin_uniform(x[k]);
+    else
+      find_bins_search(x, idx, n, std::is_same<edge_t,float>());
+  }
+
+  static constexpr size_type bin_index_max_edges = ::bin_index_max_edges;
+
+protected:
+  void find_bins_search(const edge_t* x, size_type* idx, size_type n,
+                        std::false_type) const noexcept {
+    for (size_type k=0; k<n; ++k) idx[k] = find_bin_search(x[k]);
+  }
+  void find_bins_search(const edge_t* x, size_type* idx, size_type n,
+                        std::true_type) const noexcept {
+    if (_edges.size() <= bin_index_max_edges)
+      bin_index(_edges.data(), _edges.size(), x, idx, n);
+    else
+      find_bins_search(x, idx, n, std::false_type());
+  }
+
+public:
+  // Batch filling.
+  // Indices are computed for blocks of fill_n_block values,
+  // then f(bin, k) is called for every k in [0,n) in order.
+  static constexpr size_type fill_n_block = 256;
+
+  // index(k0, m, idx) must write the indices of values [k0,k0+m) to idx
+  template <typename Index, typename F>
+  void fill_n_with(Index&& index, size_type n, F&& f) {
+    size_type idx[fill_n_block];
+    for (size_type k0=0; k0<n; k0+=fill_n_block) {
+      size_type m = n-k0;
+      if (m > fill_n_block) m = fill_n_block;
+      index(k0, m, idx);
+      for (size_type k=0; k<m; ++k) f(_bins[idx[k]], k0+k);
+    }
+  }
+
+  template <typename F>
+  void fill_n(const edge_t* x, size_type n, F&& f) {
+    fill_n_with([this,x](size_type k0, size_type m, size_type* idx){
+      find_bins(x+k0, idx, m);
+    }, n, std::forward<F>(f));
+  }
+
+  template <typename W>
+  void fill_n(const edge_t* x, const W* w, size_type n) {
+    fill_n(x, n, [w](bin_t& bin, size_type k){ filler_t()(bin, w[k]); });
+  }
+
+  //---------------------------------------------
+
   template <typename... TT>
   void fill_bin(size_type i) { ++_bins.at(i); }
 
@@ -208,7 +314,6 @@ public:
 
   inline const std::vector<edge_t>& edges() const noexcept { return _edges; }
   inline const std::vector< bin_t>&  bins() const noexcept { return _bins;  }
-  inline std::vector<edge_t>& edges() noexcept { return _edges; }
   inline std::vector< bin_t>&  bins() noexcept { return _bins;  }
 };
 
@@ -3,7 +3,11 @@
 #ifndef ttree_branches_hh
 #define ttree_branches_hh
 
+#include <string>
+#include <vector>
+
 #include <TTree.h>
+#include <TTreeCache.h>
 
 template<typename T>
 inline void branches_impl(TTree* tree, const char* name, T* ptr) {
@@ -71,5 +75,23 @@ inline void branches_set_on(
   branches_set_on(tree,bb...);
 }
 
+//===============================================
+
+// Tree cache of the given size in bytes, holding exactly the given
+// branches. The learning phase is skipped, since the branches are known.
+// With prefetch, baskets are read asynchronously ahead of the loop.
+inline void branches_cache(
+  TTree* tree, Long64_t bytes, const std::vector<std::string>& names,
+  bool prefetch=false
+) {
+  tree->SetCacheSize(bytes);
+  if (bytes <= 0) return;
+  for (const auto& name : names) tree->AddBranchToCache(name.c_str(),true);
+  tree->StopCacheLearningPhase();
+  if (prefetch) {
+    TTreeCache *cache = tree->GetReadCache(tree->GetCurrentFile());
+    if (cache) cache->SetEnablePrefetching(true);
+  }
+}
 
 #endif
@@ -0,0 +1,113 @@
+#ifndef signif_checkpoint_hh
+#define signif_checkpoint_hh
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <fstream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdint>
+#include <cerrno>
+
+#include <sys/stat.h>
+
+#include "file_id.hh"
+#include "fnv1a.hh"
+
+/*
+ * Partial sums of input files, saved as soon as a file is processed,
+ * so that a rerun only processes new or changed files.
+ *
+ * A checkpoint is named by a hash of the file_id() of the input file,
+ * whether it is read as data or MC, and a description of the
+ * configuration the sums depend on.
+ * All of them are stored in the checkpoint and compared when it is read,
+ * as are the sizes of the arrays.
+ * Arrays are written as raw doubles to a temporary file, which is
+ * renamed at the end, so a killed job never leaves a partial one.
+ */
+
+// Arrays of doubles, each as its size followed by the raw values.
+// read_arrays() is false if a stored size differs from its array.
+inline void write_arrays(std::ostream& f,
+    const std::vector<const std::vector<double>*>& arrays) {
+  for (const auto *a : arrays) {
+    const uint64_t n = a->size();
+    f.write(reinterpret_cast<const char*>(&n),sizeof(n));
+    f.write(reinterpret_cast<const char*>(a->data()),n*sizeof(double));
+  }
+}
+inline bool read_arrays(std::istream& f,
+    const std::vector<std::vector<double>*>& arrays) {
+  for (auto *a : arrays) {
+    uint64_t n;
+    if (!f.read(reinterpret_cast<char*>(&n),sizeof(n)) || n!=a->size())
+      return false;
+    if (!f.read(reinterpret_cast<char*>(a->data()),n*sizeof(double)))
+      return false;
+  }
+  return true;
+}
+
+class checkpoints {
+  std::string dir;
+
+  // file id, sample and configuration, a line each
+  static std::string key(const std::string& id, bool mc,
+                         const std::string& config) {
+    return id + '\n' + (mc ? "mc" : "data") + '\n' + config + '\n';
+  }
+
+  std::string path(const std::string& key) const {
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx",
+             (unsigned long long)fnv1a(key));
+    return dir + '/' + name + ".ckpt";
+  }
+
+  static std::string header(const std::string& key) {
+    return "signif checkpoint\n" + key;
+  }
+
+public:
+  checkpoints(const std::string& dir): dir(dir) {
+    if (::mkdir(dir.c_str(),0777) && errno!=EEXIST)
+      throw std::runtime_error("cannot create directory "+dir);
+  }
+
+  // false if there is no matching checkpoint;
+  // config must not contain newlines
+  bool read(const std::string& file, bool mc, const std::string& config,
+            const std::vector<std::vector<double>*>& arrays) const {
+    const std::string id = file_id(file);
+    if (id.empty()) return false;
+    const std::string k = key(id,mc,config);
+    std::ifstream f(path(k), std::ios::binary);
+    if (!f) return false;
+    const std::string head = header(k);
+    std::string buf(head.size(),'\0');
+    if (!f.read(&buf[0],buf.size()) || buf!=head) return false;
+    return read_arrays(f,arrays);
+  }
+
+  void write(const std::string& file, bool mc, const std::string& config,
+             const std::vector<const std::vector<double>*>& arrays) const {
+    const std::string id = file_id(file);
+    if (id.empty()) return;
+    const std::string k = key(id,mc,config);
+    const std::string fname = path(k), tmp = fname + ".tmp";
+    {
+      std::ofstream f(tmp, std::ios::binary);
+      const std::string head = header(k);
+      f.write(head.data(),head.size());
+      write_arrays(f,arrays);
+      if (!f) throw std::runtime_error("cannot write "+tmp);
+    }
+    if (std::rename(tmp.c_str(),fname.c_str()))
+      throw std::runtime_error("cannot write "+fname);
+  }
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef snip_counter_rng_hh
+#define snip_counter_rng_hh
+
+#include <cstdint>
+
+/*
+ * Counter-based random numbers.
+ *
+ * Draw i of a key is a hash of the key and i, the SplitMix64 sequence
+ * started from the mixed key, so any draw can be computed directly
+ * without generator state. Results then depend only on the keys,
+ * not on the order or the thread in which they are drawn.
+ */
+
+class counter_rng {
+  uint64_t state;
+
+  static constexpr uint64_t golden = 0x9E3779B97F4A7C15ull;
+
+  static inline uint64_t mix(uint64_t z) noexcept {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+
+public:
+  counter_rng(uint64_t key) noexcept: state(mix(key)) { }
+
+  inline uint64_t operator()(uint64_t i) const noexcept {
+    return mix(state + (i+1)*golden);
+  }
+
+  // Poisson(1) from the upper 32 bits of draw i, by inverse CDF
+  unsigned poisson1(uint64_t i) const noexcept {
+    // CDF of Poisson(1) times 2^32
+    static constexpr uint32_t cdf[] = {
+      1580030168u, 3160060337u, 3950075421u, 4213413783u,
+      4279248373u, 4292415291u, 4294609777u, 4294923276u,
+      4294962463u, 4294966817u, 4294967252u, 4294967292u
+    };
+    const uint32_t u = (*this)(i) >> 32;
+    unsigned k = 0;
+    while (k < 12 && u >= cdf[k]) ++k;
+    return k;
+  }
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef snip_cumulative_hh
+#define snip_cumulative_hh
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+
+/*
+ * Running sums over fine bins.
+ *
+ * Constructed from nedges fine edges and nedges+1 bin values, including
+ * underflow and overflow, same convention as in binner.
+ * below(e) is the sum of all bins below edge e, so the sum over any
+ * coarse bin [a,b), where a and b are fine edges, is below(b)-below(a).
+ * -inf and +inf are accepted as edges, giving underflow and overflow
+ * of the coarse binning.
+ */
+
+template <typename Edge = double, typename T = double>
+class cumulative {
+public:
+  typedef Edge edge_t;
+  typedef T value_t;
+  typedef unsigned size_type;
+
+protected:
+  std::vector<edge_t> _edges;
+  std::vector<value_t> _below; // _below[i] = sum of bins below _edges[i]
+  value_t _total;
+
+public:
+  cumulative(): _total(0) { }
+
+  cumulative(const edge_t* edges, size_type nedges, const value_t* values)
+  : _edges(edges, edges+nedges), _below(nedges), _total(0)
+  {
+    for (size_type i=0; i<nedges; ++i) {
+      _total += values[i];
+      _below[i] = _total;
+    }
+    _total += values[nedges];
+  }
+
+  // sum of all bins below edge e, which must be one of the fine edges
+  value_t below(edge_t e) const {
+    const auto it = std::lower_bound(_edges.begin(), _edges.end(), e);
+    if (it != _edges.end() && *it == e) return _below[it-_edges.begin()];
+    if (std::isinf(e)) return e < 0 ? value_t(0) : _total;
+    throw std::runtime_error("cumulative: not a fine edge");
+  }
+
+  inline value_t sum(edge_t a, edge_t b) const { return below(b)-below(a); }
+
+  inline value_t total() const noexcept { return _total; }
+
+  inline bool has_edge(edge_t e) const {
+    return std::isinf(e) || std::binary_search(_edges.begin(), _edges.end(), e);
+  }
+
+  inline const std::vector<edge_t>& edges() const noexcept { return _edges; }
+};
+
+#endif
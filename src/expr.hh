@@ -0,0 +1,254 @@
+#ifndef snip_expr_hh
+#define snip_expr_hh
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+/*
+ * Arithmetic expressions of tree branches, e.g. abs(Dphi_j_j) or
+ * pT_yy/m_yy, compiled once to a program for a stack machine.
+ * The program is run over columns of events: every instruction is
+ * a loop over the whole column, so there is no per-event dispatch
+ * and the loops are vectorized.
+ *
+ *   expr    := term { (+|-) term }
+ *   term    := factor { (*|/) factor }
+ *   factor  := -factor | number | func(expr) | (expr) | branch
+ *   func    := abs | sqrt | log | exp
+ *   branch  := name[:int|:float]
+ *
+ * Branches are float unless declared :int. A branch without a type
+ * takes the type it was declared with in an earlier expression.
+ * Branch values are converted to float when they are loaded; the
+ * result is int if it only adds, subtracts, multiplies and takes
+ * abs() of int branches and integer constants.
+ */
+
+union expr_value { float f; int32_t i; };
+
+struct expr_branch {
+  std::string name;
+  bool is_int;
+};
+
+class expr {
+public:
+  enum op_t : uint8_t {
+    load_f, load_i, constant, add, sub, mul, div, neg, abs, sqrt, log, exp,
+    add_c, sub_c, mul_c, div_c // right operand is the constant c
+  };
+  struct instr { op_t op; unsigned arg; float c; };
+
+private:
+  std::vector<instr> code;
+  unsigned depth;
+  bool is_int_;
+
+  // Recursive descent parser, generating code as it goes.
+  // Types of the values on the stack are tracked for the result type.
+  class parser {
+    const std::string& s;
+    size_t p;
+    std::vector<expr_branch>& branches;
+    expr& e;
+    std::vector<bool> types;
+
+    [[noreturn]] void error(const std::string& what) const {
+      throw std::runtime_error("expression "+s+": "+what+" at "
+        +(p<s.size() ? "\""+s.substr(p)+"\"" : "end"));
+    }
+    bool next(char c) {
+      if (p<s.size() && s[p]==c) { ++p; return true; }
+      return false;
+    }
+    static bool name_char(char c, bool first) {
+      return c=='_' || (c>='a' && c<='z') || (c>='A' && c<='Z')
+          || (!first && ((c>='0' && c<='9') || c=='.'));
+    }
+    std::string name() {
+      const size_t a = p;
+      while (p<s.size() && name_char(s[p],p==a)) ++p;
+      return s.substr(a,p-a);
+    }
+
+    void emit(op_t op, unsigned arg=0, float c=0) {
+      e.code.push_back({op,arg,c});
+    }
+    void push(bool is_int) {
+      types.push_back(is_int);
+      if (types.size() > e.depth) e.depth = types.size();
+    }
+    // Binary operation; a constant right operand is folded into it
+    void binary(op_t op, op_t op_c, bool int_result) {
+      const bool is_int = int_result && types.back() && types[types.size()-2];
+      types.pop_back();
+      types.back() = is_int;
+      if (e.code.back().op==constant) {
+        e.code.back().op = op_c;
+      } else emit(op);
+    }
+
+    void branch(const std::string& b) {
+      int type = -1;
+      if (next(':')) {
+        const std::string t = name();
+        if (t=="int") type = 1;
+        else if (t=="float") type = 0;
+        else error("unknown type "+t);
+      }
+      unsigned i = 0;
+      for (; i<branches.size(); ++i) if (branches[i].name==b) break;
+      if (i==branches.size()) branches.push_back({b,type==1});
+      else if (type!=-1 && bool(type)!=branches[i].is_int)
+        error("conflicting types of branch "+b);
+      emit(branches[i].is_int ? load_i : load_f, i);
+      push(branches[i].is_int);
+    }
+
+    void factor() {
+      if (next('-')) {
+        factor();
+        if (e.code.back().op==constant) e.code.back().c = -e.code.back().c;
+        else emit(neg);
+      } else if (next('(')) {
+        sum();
+        if (!next(')')) error("expected )");
+      } else if (p<s.size() && ((s[p]>='0' && s[p]<='9') || s[p]=='.')) {
+        const char *a = s.c_str()+p;
+        char *b;
+        const double x = std::strtod(a,&b);
+        if (b==a) error("bad number");
+        const std::string num = s.substr(p,b-a);
+        p += b-a;
+        emit(constant,0,x);
+        push(x==std::floor(x) && num.find_first_of(".eE")==std::string::npos);
+      } else {
+        const std::string f = name();
+        if (f.empty()) error("expected a branch or a number");
+        if (!next('(')) return branch(f);
+        op_t op;
+        if (f=="abs") op = abs;
+        else if (f=="sqrt") op = sqrt;
+        else if (f=="log") op = log;
+        else if (f=="exp") op = exp;
+        else error("unknown function "+f);
+        sum();
+        if (!next(')')) error("expected )");
+        emit(op);
+        if (op!=abs) types.back() = false;
+      }
+    }
+    void term() {
+      factor();
+      for (;;) {
+        if (next('*')) { factor(); binary(mul,mul_c,true); }
+        else if (next('/')) { factor(); binary(div,div_c,false); }
+        else break;
+      }
+    }
+    void sum() {
+      term();
+      for (;;) {
+        if (next('+')) { term(); binary(add,add_c,true); }
+        else if (next('-')) { term(); binary(sub,sub_c,true); }
+        else break;
+      }
+    }
+
+  public:
+    parser(const std::string& s, std::vector<expr_branch>& branches, expr& e)
+    : s(s), p(0), branches(branches), e(e) { }
+
+    void operator()() {
+      sum();
+      if (p!=s.size()) error("unexpected character");
+      e.is_int_ = types.back();
+    }
+  };
+
+public:
+  // Compiles src, adding the branches it reads to branches.
+  // Throws std::runtime_error on syntax errors.
+  expr(const std::string& src, std::vector<expr_branch>& branches)
+  : depth(0), is_int_(false) {
+    parser(src,branches,*this)();
+  }
+
+  inline bool is_int() const noexcept { return is_int_; }
+
+  // Number of columns of stack the program needs
+  inline unsigned stack_size() const noexcept { return depth; }
+
+  // Index of the branch if the expression is a branch, or abs() of one,
+  // so that it can be read without running the program; -1 otherwise
+  int branch(bool& take_abs) const noexcept {
+    take_abs = code.size()==2 && code[1].op==abs;
+    if ((code[0].op!=load_f && code[0].op!=load_i)
+        || code.size()!=1u+take_abs) return -1;
+    return code[0].arg;
+  }
+
+  // Indices of the branches the expression reads
+  std::vector<unsigned> reads() const {
+    std::vector<unsigned> b;
+    for (const instr& x : code)
+      if ((x.op==load_f || x.op==load_i)
+          && std::find(b.begin(),b.end(),x.arg)==b.end())
+        b.push_back(x.arg);
+    return b;
+  }
+
+  // out[k] for event k of the columns of branches.
+  // stack has room for (stack_size()-1)*n values;
+  // out is the bottom of the stack.
+  void operator()(const expr_value* const* cols, float* out, unsigned n,
+                  float* stack) const noexcept {
+    float *top = nullptr;
+    for (const instr& x : code) {
+      float *a = top, *b;
+      switch (x.op) {
+        case load_f: {
+          top = top ? (top==out ? stack : top+n) : out;
+          const expr_value *c = cols[x.arg];
+          for (unsigned k=0; k<n; ++k) top[k] = c[k].f;
+        } break;
+        case load_i: {
+          top = top ? (top==out ? stack : top+n) : out;
+          const expr_value *c = cols[x.arg];
+          for (unsigned k=0; k<n; ++k) top[k] = c[k].i;
+        } break;
+        case constant:
+          top = top ? (top==out ? stack : top+n) : out;
+          for (unsigned k=0; k<n; ++k) top[k] = x.c;
+          break;
+        case neg:  for (unsigned k=0; k<n; ++k) a[k] = -a[k]; break;
+        case abs:  for (unsigned k=0; k<n; ++k) a[k] = std::fabs(a[k]); break;
+        case sqrt: for (unsigned k=0; k<n; ++k) a[k] = std::sqrt(a[k]); break;
+        case log:  for (unsigned k=0; k<n; ++k) a[k] = std::log(a[k]); break;
+        case exp:  for (unsigned k=0; k<n; ++k) a[k] = std::exp(a[k]); break;
+        case add_c: for (unsigned k=0; k<n; ++k) a[k] += x.c; break;
+        case sub_c: for (unsigned k=0; k<n; ++k) a[k] -= x.c; break;
+        case mul_c: for (unsigned k=0; k<n; ++k) a[k] *= x.c; break;
+        case div_c: for (unsigned k=0; k<n; ++k) a[k] /= x.c; break;
+        default: // binary operations on the two top columns
+          top = (top==stack ? out : top-n);
+          b = a;
+          a = top;
+          switch (x.op) {
+            case add: for (unsigned k=0; k<n; ++k) a[k] += b[k]; break;
+            case sub: for (unsigned k=0; k<n; ++k) a[k] -= b[k]; break;
+            case mul: for (unsigned k=0; k<n; ++k) a[k] *= b[k]; break;
+            case div: for (unsigned k=0; k<n; ++k) a[k] /= b[k]; break;
+            default: ;
+          }
+      }
+    }
+  }
+};
+
+#endif
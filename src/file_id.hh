@@ -0,0 +1,25 @@
+#ifndef snip_file_id_hh
+#define snip_file_id_hh
+
+#include <string>
+#include <sstream>
+#include <cstdlib>
+#include <climits>
+
+#include <sys/stat.h>
+
+// Identity of a file: absolute path, size and modification time,
+// separated by tabs, or empty if the file cannot be stat'ed.
+// It changes when the file is replaced or modified.
+inline std::string file_id(const std::string& path) {
+  struct stat st;
+  if (::stat(path.c_str(),&st)) return { };
+  char abs[PATH_MAX];
+  if (!::realpath(path.c_str(),abs)) return { };
+  std::ostringstream ss;
+  ss << abs << '\t' << st.st_size << '\t'
+     << st.st_mtim.tv_sec << '.' << st.st_mtim.tv_nsec;
+  return ss.str();
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef snip_fnv1a_hh
+#define snip_fnv1a_hh
+
+#include <string>
+#include <cstdint>
+
+// 64-bit FNV-1a hash, which is the same on every platform and build
+inline uint64_t fnv1a(const std::string& s) noexcept {
+  uint64_t h = 0xCBF29CE484222325ull;
+  for (unsigned char c : s) {
+    h ^= c;
+    h *= 0x100000001B3ull;
+  }
+  return h;
+}
+
+#endif
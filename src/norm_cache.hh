@@ -0,0 +1,102 @@
+#ifndef signif_norm_cache_hh
+#define signif_norm_cache_hh
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <stdexcept>
+#include <cstdio>
+
+#include "file_id.hh"
+
+/*
+ * Cache of what is read from an input file before the event loop:
+ * the MC normalisation from the cutflow histogram, the number of
+ * entries and the cluster boundaries of the tree.
+ *
+ * Entries are keyed by file_id(), absolute path, size and modification
+ * time, so a file that is replaced or modified is read again.
+ *
+ * Text file, one tab-separated line per input file:
+ *   path size mtime entries n_all cutflow_name bin_label clusters...
+ */
+
+class norm_cache {
+public:
+  struct info {
+    long long entries;
+    double n_all;
+    std::string cutflow, label; // empty for data
+    std::vector<long long> clusters; // first entries of clusters
+    info(): entries(0), n_all(1) { }
+  };
+
+private:
+  std::string fname;
+  std::map<std::string,info> table;
+  bool modified;
+
+public:
+  norm_cache(const std::string& fname): fname(fname), modified(false) {
+    std::ifstream f(fname);
+    std::string line;
+    while (std::getline(f,line)) {
+      std::vector<std::string> tok;
+      for (size_t a=0, b; ; a=b+1) {
+        b = line.find('\t',a);
+        tok.push_back(line.substr(a,b-a));
+        if (b==std::string::npos) break;
+      }
+      if (tok.size() < 7) continue;
+      info x;
+      x.entries = std::stoll(tok[3]);
+      x.n_all = std::stod(tok[4]);
+      x.cutflow = tok[5];
+      x.label = tok[6];
+      for (size_t i=7; i<tok.size(); ++i) x.clusters.push_back(std::stoll(tok[i]));
+      table[tok[0]+'\t'+tok[1]+'\t'+tok[2]] = x;
+    }
+  }
+
+  bool find(const std::string& path, info& x) const {
+    const auto it = table.find(file_id(path));
+    if (it == table.end()) return false;
+    x = it->second;
+    return true;
+  }
+
+  // false if the file cannot be identified, e.g. a root:// URL,
+  // in which case it is not cached
+  bool insert(const std::string& path, const info& x) {
+    const std::string k = file_id(path);
+    if (k.empty()) return false;
+    table[k] = x;
+    modified = true;
+    return true;
+  }
+
+  // written to a temporary file and renamed, so that concurrent runs
+  // never see a partial cache
+  void save() {
+    if (!modified) return;
+    const std::string tmp = fname + ".tmp";
+    {
+      std::ofstream f(tmp);
+      f.precision(17);
+      for (const auto& e : table) {
+        const info& x = e.second;
+        f << e.first << '\t' << x.entries << '\t' << x.n_all
+          << '\t' << x.cutflow << '\t' << x.label;
+        for (long long c : x.clusters) f << '\t' << c;
+        f << '\n';
+      }
+      if (!f) throw std::runtime_error("cannot write "+tmp);
+    }
+    if (std::rename(tmp.c_str(),fname.c_str()))
+      throw std::runtime_error("cannot write "+fname);
+    modified = false;
+  }
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef snip_parking_hh
+#define snip_parking_hh
+
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+
+/*
+ * Waiting for a condition made true by another thread.
+ *
+ * The condition is polled a bounded number of times, yielding in
+ * between, so short waits do not pay for a sleep. Then the thread
+ * sleeps on a condition variable until it is notified, instead of
+ * taking a core away from the threads it is waiting for.
+ *
+ * The other thread makes the condition true and then calls notify(),
+ * which only takes the lock if a thread is asleep. The fences on both
+ * sides ensure that either the sleeper sees the condition or the
+ * notifier sees the sleeper.
+ */
+
+class parking {
+  std::mutex m;
+  std::condition_variable cv;
+  std::atomic<unsigned> sleepers;
+
+public:
+  static constexpr unsigned spins = 64;
+
+  parking(): sleepers(0) { }
+  parking(const parking&) = delete;
+
+  template <typename Ready>
+  void wait(Ready ready) {
+    for (unsigned i=0; i<spins; ++i) {
+      if (ready()) return;
+      std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lock(m);
+    sleepers.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    cv.wait(lock, ready);
+    sleepers.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  void notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(m);
+      cv.notify_all();
+    }
+  }
+};
+
+#endif
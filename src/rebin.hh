@@ -0,0 +1,58 @@
+#ifndef signif_rebin_hh
+#define signif_rebin_hh
+
+#include <vector>
+#include <limits>
+
+/*
+ * Optimal merging of adjacent bins.
+ *
+ * Given per-bin sums s[0..n) and b[0..n), find the partition of bins
+ * into contiguous groups, each with sum of s >= smin and sum of b >= bmin,
+ * that maximizes the sum of score(s,b) over the groups.
+ *
+ * Dynamic programming over prefix sums, so every candidate group is
+ * evaluated in O(1), and the whole search takes O(n^2) evaluations.
+ *
+ * Returns group boundaries 0 = i_0 < i_1 < ... < i_k = n,
+ * or an empty vector if no partition satisfies the constraints.
+ */
+
+template <typename Score>
+std::vector<unsigned> optimal_merge(
+  const double* s, const double* b, unsigned n,
+  double smin, double bmin, Score&& score
+) {
+  std::vector<double> S(n+1), B(n+1);
+  S[0] = B[0] = 0;
+  for (unsigned i=0; i<n; ++i) {
+    S[i+1] = S[i] + s[i];
+    B[i+1] = B[i] + b[i];
+  }
+
+  const double none = -std::numeric_limits<double>::infinity();
+  std::vector<double> best(n+1, none);
+  std::vector<unsigned> prev(n+1, 0);
+  best[0] = 0;
+
+  for (unsigned j=1; j<=n; ++j) {
+    for (unsigned i=0; i<j; ++i) {
+      if (best[i] == none) continue;
+      const double ds = S[j]-S[i], db = B[j]-B[i];
+      if (ds < smin || db < bmin) continue;
+      const double x = best[i] + score(ds,db);
+      if (x > best[j]) {
+        best[j] = x;
+        prev[j] = i;
+      }
+    }
+  }
+
+  std::vector<unsigned> bounds;
+  if (best[n] == none) return bounds;
+  for (unsigned j=n; j; j=prev[j]) bounds.push_back(j);
+  bounds.push_back(0);
+  return { bounds.rbegin(), bounds.rend() };
+}
+
+#endif
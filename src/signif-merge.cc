@@ -0,0 +1,102 @@
+// Merges shards of sums written by signif --shard into the output
+// of signif. Takes the same options as signif, usually the same
+// configuration file, and checks that the shards were filled with
+// the same binning.
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+
+#include "analysis.hh"
+
+int main(int argc, char* argv[])
+{
+  string cfname;
+  vector<string> shards;
+  settings set;
+
+  // options ---------------------------------------------------
+  try {
+    po::options_description desc("Options");
+    desc.add_options()
+      ("shards", po::value(&shards)->multitoken()->required(),
+       "shard files written by signif --shard")
+      ("conf,c", po::value(&cfname),
+       "configuration file")
+    ;
+    add_options(desc,set);
+
+    po::positional_options_description pos;
+    pos.add("shards",-1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv)
+      .options(desc).positional(pos).run(), vm);
+    if (argc == 1) {
+      cout << desc << endl;
+      return 0;
+    }
+    // options of signif that only affect the event loop are ignored
+    if (vm.count("conf")) {
+      po::store( po::parse_config_file<char>(
+        vm["conf"].as<string>().c_str(), desc, true), vm);
+    }
+    po::notify(vm);
+
+    if (set.ofname.empty()) throw po::error("output file is required");
+
+    apply_options(set);
+  } catch (exception& e) {
+    cerr << "\033[31m" << argv[0]
+         << " options: " <<  e.what() <<"\033[0m"<< endl;
+    return 1;
+  }
+  // end options ---------------------------------------------------
+
+  const auto wall_start = chrono::steady_clock::now();
+
+  unique_ptr<stage_profile> profile;
+  if (set.prof_print || !set.prof_json.empty())
+    profile.reset(new stage_profile(stage::names,1));
+  stage_time *prof = profile ? profile->row(0) : nullptr;
+
+  binnings bins;
+  vector<input_file> inputs;
+  vector<accum> file_sums;
+  try {
+    bins = read_binnings(set);
+    const string config = sums_config(bins.vars);
+    scoped_timer tm(at(prof,stage::open));
+    for (const auto& f : shards) {
+      const size_t n = inputs.size();
+      read_shard(f, config, bins.vars, inputs, file_sums);
+      cout << "Shard: " << f << " (" << inputs.size()-n << " files)" << endl;
+    }
+  } catch (exception& e) {
+    cerr << "\033[31m" << e.what() <<"\033[0m"<< endl;
+    return 1;
+  }
+
+  if (int status = finish(set, bins, inputs, file_sums, prof))
+    return status;
+
+  if (profile) {
+    const double wall = chrono::duration<double>(
+      chrono::steady_clock::now() - wall_start).count();
+    if (set.prof_print) {
+      cout << "============" << endl;
+      profile->print(cout,wall);
+    }
+    if (!set.prof_json.empty()) {
+      ofstream f(set.prof_json);
+      profile->write_json(f,wall);
+    }
+  }
+
+  return 0;
+}
@@ -1,135 +1,728 @@
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <sstream>
 #include <vector>
 #include <string>
 #include <utility>
 #include <memory>
 #include <cmath>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <exception>
+#include <stdexcept>
 
-#include <boost/program_options.hpp>
-
+#include <TROOT.h>
 #include <TFile.h>
 #include <TTree.h>
+#include <TBranch.h>
+#include <TLeaf.h>
+#include <TObjArray.h>
 #include <TH1.h>
 #include <TKey.h>
 #include <TAxis.h>
+#include <TTreePerfStats.h>
 
+#include "analysis.hh"
 #include "branches.hh"
-#include "binner.hh"
 #include "timed_counter.hh"
-#include "in.hh"
+#include "work_stealing.hh"
+#include "skim.hh"
+#include "spsc_queue.hh"
+#include "parking.hh"
+#include "norm_cache.hh"
+#include "counter_rng.hh"
+#include "checkpoint.hh"
+#include "file_id.hh"
+#include "fnv1a.hh"
 
-using namespace std;
-namespace po = boost::program_options;
+// tree cache size in MB, asynchronous prefetch, I/O statistics
+struct { double cache; bool prefetch, stats; } io;
 
-#define test(var) \
-  std::cout <<"\033[36m"<< #var <<"\033[0m"<< " = " << var << std::endl;
+// Key of the bootstrap weights of an event, which depends only on the
+// seed, the name of the file and the entry, not on how the input is
+// split between jobs or shards
+inline uint64_t file_key(const string& name) noexcept {
+  return fnv1a(name.substr(name.rfind('/')+1));
+}
+inline uint64_t event_key(uint64_t file, Long64_t ent) noexcept {
+  return (bootstrap.seed*0x9E3779B97F4A7C15ull ^ file) + uint64_t(ent);
+}
 
-constexpr pair<double,double> mass_range {105000.,160000.};
-constexpr pair<double,double> mass_window{121000.,129000.};
+// Time of a task loop not spent reading, filling or waiting for
+// the filling thread, which is the selection, added to the select stage
+class select_timer {
+  typedef chrono::steady_clock clock_type;
+  stage_time *prof;
+  double read0, wait0, fill0;
+  clock_type::time_point start;
 
-constexpr double len(pair<double,double> p) {
-  return p.second - p.first;
+public:
+  select_timer(stage_time* prof): prof(prof) {
+    if (!prof) return;
+    read0 = prof[stage::read].time;
+    wait0 = prof[stage::wait].time;
+    fill0 = prof[stage::fill].time;
+    start = clock_type::now();
+  }
+  select_timer(const select_timer&) = delete;
+  ~select_timer() {
+    if (!prof) return;
+    prof[stage::select].time +=
+      chrono::duration<double>(clock_type::now() - start).count()
+      - (prof[stage::read].time - read0) - (prof[stage::wait].time - wait0)
+      - (prof[stage::fill].time - fill0);
+    ++prof[stage::select].calls;
+  }
+};
+
+// Range of entries [first,last) of one input file
+struct task {
+  size_t file;
+  Long64_t first, last;
+};
+
+TFile* open_file(const string& name, stage_time* prof) {
+  scoped_timer tm(at(prof,stage::open));
+  TFile *file = new TFile(name.c_str(),"read");
+  if (file->IsZombie()) {
+    delete file;
+    throw runtime_error("cannot open file "+name);
+  }
+  return file;
 }
-template <typename T1, typename T2, typename T3>
-inline bool in(T1 x, const pair<T2,T3>& p) noexcept {
-  return (p.first < x && x < p.second);
+
+TTree* get_tree(TFile* file) {
+  TTree* tree = (TTree*)file->Get("CollectionTree");
+  if (!tree)
+    throw runtime_error(string("no CollectionTree in ")+file->GetName());
+  return tree;
 }
 
-constexpr double factor = len(mass_window)/(len(mass_range)-len(mass_window));
+// Read the MC normalisation and the cluster boundaries of an input file
+norm_cache::info scan(const input_file& input, stage_time* prof) {
+  norm_cache::info x;
+  unique_ptr<TFile> file(open_file(input.name,prof));
 
-struct { double in, need, fac; } lumi;
+  if (input.mc) {
+    scoped_timer tm(at(prof,stage::cutflow));
+    TIter next(file->GetListOfKeys());
+    TKey *key;
+    while ((key = static_cast<TKey*>(next()))) {
+      string name(key->GetName());
+      if (name.substr(0,8)!="CutFlow_" ||
+          name.substr(name.size()-18)!="_noDalitz_weighted") continue;
+      TH1 *h = static_cast<TH1*>(key->ReadObj());
+      x.cutflow = h->GetName();
+      x.n_all = h->GetBinContent(3);
+      x.label = h->GetXaxis()->GetBinLabel(3);
+      break;
+    }
+  }
 
-bool mc_file;
+  TTree* tree = get_tree(file.get());
+  x.entries = tree->GetEntries();
+  auto clusters = tree->GetClusterIterator(0);
+  for (Long64_t ent; (ent = clusters.Next()) < x.entries; )
+    x.clusters.push_back(ent);
 
-class bkg_sig {
-  double bkg_tmp, sig_tmp;
-public:
-  double bkg, sig;
-  bkg_sig(): bkg_tmp(0), sig_tmp(0), bkg(0), sig(0) { }
-  void operator()(double m, double w) noexcept {
-    bool in_window = in(m,mass_window);
-    if ( mc_file && in_window ) sig_tmp += w;
-    else if ( !mc_file && !in_window ) bkg_tmp += w;
-  }
-  void merge(double n) {
-    if (mc_file) {
-      sig += sig_tmp/n;
-      sig_tmp = 0.;
+  file->Close();
+  return x;
+}
+
+// Read the MC normalisation of every input file, from the cache if
+// the file has not changed, and split the tree into cluster-aligned
+// ranges of at least chunk entries.
+void plan(vector<input_file>& inputs, Long64_t chunk, vector<task>& tasks,
+          norm_cache* cache, stage_time* prof) {
+  for (size_t f=0; f<inputs.size(); ++f) {
+    input_file& input = inputs[f];
+    norm_cache::info x;
+    const bool cached = cache && cache->find(input.name,x);
+    if (!cached) {
+      x = scan(input,prof);
+      if (cache && !cache->insert(input.name,x))
+        cerr << "\033[33m" << input.name << " cannot be stat'ed"
+                " and is not cached\033[0m" << endl;
+    }
+
+    cout << ( input.mc ? "MC:" : "Data:" ) << ' ' << input.name
+         << (cached ? " (cached)" : "") << endl;
+    if (!x.cutflow.empty()) {
+      input.n_all = x.n_all;
+      cout << x.cutflow << endl;
+      cout << x.label << " = " << input.n_all << endl;
+    }
+
+    const Long64_t nent = x.entries;
+    if (chunk <= 0) {
+      tasks.push_back({f,0,nent});
     } else {
-      bkg += bkg_tmp/n;
-      bkg_tmp = 0.;
+      Long64_t first = 0;
+      for (Long64_t ent : x.clusters) {
+        if (ent - first >= chunk) {
+          tasks.push_back({f,first,ent});
+          first = ent;
+        }
+      }
+      if (first < nent) tasks.push_back({f,first,nent});
     }
   }
-  double signif() {
-    return sig!=0 ? lumi.fac * sig / sqrt(sig + factor * bkg) : 0;
+}
+
+// Split every file of a skim into ranges of chunk events
+void plan(const skim::file& sk, Long64_t chunk,
+          vector<input_file>& inputs, vector<task>& tasks) {
+  for (const auto& e : sk.entries()) {
+    const size_t f = inputs.size();
+    inputs.emplace_back(e.name,e.mc);
+    inputs.back().n_all = e.n_all;
+    cout << ( e.mc ? "MC:" : "Data:" ) << ' ' << e.name
+         << " (skim, " << e.nevents << " events)" << endl;
+
+    const Long64_t nent = e.nevents;
+    if (chunk <= 0) tasks.push_back({f,0,nent});
+    else for (Long64_t first=0; first<nent; first+=chunk)
+      tasks.push_back({f,first,min(first+chunk,nent)});
+  }
+}
+
+// Skim columns, in the order they are stored:
+// the selection branches, then the branches of the variables
+vector<skim::column> skim_columns(const var_set& vars) {
+  vector<skim::column> cols {
+    {"weight",false}, {"crossSectionBRfilterEff",false}, {"m_yy",false}
+  };
+  for (const auto& b : vars.branches)
+    if (b.name!="m_yy") cols.push_back({b.name,b.is_int});
+  return cols;
+}
+
+// Selected events of one block, column by column.
+// Only events that count for the sample in some window are buffered,
+// with a weight per window that is 0 where the event does not count,
+// so the mass windows do not have to be checked again.
+struct event_block {
+  static constexpr size_t size_max = 4096;
+  vector<Float_t> w; // weights of event k at k*windows.size()
+  vector<Int_t> njets;
+  vector<uint64_t> key; // event_key(), only with bootstrap replicas
+  vector<vector<var_value>> x; // values of every branch of the variables
+  accum *acc; // accumulators the block is filled into
+
+  event_block(const var_set& vars): x(vars.branches.size()), acc(nullptr) {
+    w.reserve(size_max*windows.size());
+    njets.reserve(size_max);
+    if (bootstrap.n) key.reserve(size_max);
+    for (auto& c : x) c.reserve(size_max);
+  }
+
+  inline size_t size() const noexcept { return njets.size(); }
+
+  void clear() noexcept {
+    w.clear();
+    njets.clear();
+    key.clear();
+    for (auto& c : x) c.clear();
   }
 };
 
-struct var {
-  string name;
-  binner<bkg_sig> bins;
-  bool take_abs;
-  union { Float_t f; Int_t i; } _x;
-  Float_t x() const noexcept {
-    Float_t out = (name[0]=='N') ? _x.i : _x.f;
-    if (take_abs) out = abs(out);
-    return out;
-  }
-
-  var(const string& str) {
-    vector<string> tok;
-    bool space = true;
-    for (char c : str) {
-      if (c==' ' || c==',') {
-        space = true;
-      } else if (space) {
-        tok.emplace_back(1,c);
-        space = false;
-      } else tok.back() += c;
+// Sums of weights and of squared weights of all windows of a bin
+inline void add_windows(double* b, const Float_t* w, unsigned nw) noexcept {
+  if (nw==1) {
+    b[0] += w[0];
+    b[1] += double(w[0])*w[0];
+  } else for (unsigned j=0; j<nw; ++j) {
+    b[2*j  ] += w[j];
+    b[2*j+1] += double(w[j])*w[j];
+  }
+}
+
+// Replica sums of a bin, b[r] += w[r]
+inline void add_replicas(double* b, const Float_t* w, unsigned n) noexcept {
+  for (unsigned r=0; r<n; ++r) b[r] += w[r];
+}
+
+// Fills blocks of events into their accumulators.
+// Local bin indices of every variable are kept for the products.
+// Weights of the bootstrap replicas are the weight of the first window
+// times Poisson(1) counts drawn from the key of the event.
+// Expressions of branches are evaluated for the whole block into buf.
+class block_binner {
+  const var_set& vars;
+  vector<vector<unsigned>> idx;
+  vector<unsigned> flat;
+  vector<Float_t> boot_w;
+  vector<const var_value*> cols;
+  vector<float> buf;
+  stage_time *prof;
+
+public:
+  block_binner(const var_set& vars, stage_time* prof)
+  : vars(vars), idx(vars.size(), vector<unsigned>(event_block::size_max)),
+    flat(vars.bank.nproducts() ? event_block::size_max : 0),
+    boot_w(event_block::size_max*bootstrap.n),
+    cols(vars.branches.size()),
+    buf(event_block::size_max*vars.stack_size), prof(prof) { }
+
+  void operator()(event_block& block) {
+    const unsigned n = block.size();
+    if (!n) return;
+    scoped_timer tm(at(prof,stage::fill));
+    accum& acc = *block.acc;
+    const unsigned nw = windows.size(), stride = accum::stride(),
+                   nb = bootstrap.n;
+    const Float_t *w = block.w.data(), *bw = boot_w.data();
+    double *bins = acc.bins.data(), *boot = acc.boot_bins.data();
+
+    if (nb) {
+      Float_t *b = boot_w.data();
+      for (unsigned k=0; k<n; ++k) {
+        const counter_rng rng(block.key[k]);
+        for (unsigned r=0; r<nb; ++r) b[k*nb+r] = w[k*nw]*rng.poisson1(r);
+      }
+    }
+
+    for (unsigned k=0; k<n; ++k) add_windows(acc.inclusive.data(), w+k*nw, nw);
+    for (unsigned k=0; k<n && nb; ++k)
+      add_replicas(acc.boot_inclusive.data(), bw+k*nb, nb);
+    for (size_t b=0; b<cols.size(); ++b) cols[b] = block.x[b].data();
+    for (size_t i=0; i<vars.size(); ++i) {
+      unsigned *ix = idx[i].data();
+      vars.find_bins(i, cols.data(), ix, n, buf.data());
+      double *b = bins + vars.bank.bin_offset(i)*stride;
+      for (unsigned k=0; k<n; ++k) add_windows(b+ix[k]*stride, w+k*nw, nw);
+      if (!nb) continue;
+      b = boot + vars.bank.bin_offset(i)*nb;
+      for (unsigned k=0; k<n; ++k) add_replicas(b+ix[k]*nb, bw+k*nb, nb);
+    }
+    for (unsigned p=0, np=vars.bank.nproducts(); p<np; ++p) {
+      unsigned *f = flat.data();
+      std::fill(f, f+n, 0u);
+      for (unsigned a=0, na=vars.bank.ndim(p); a<na; ++a) {
+        const unsigned *ix = idx[vars.bank.axis(p,a)].data(),
+                       stride = vars.bank.stride(p,a);
+        for (unsigned k=0; k<n; ++k) f[k] += ix[k]*stride;
+      }
+      double *b = bins + vars.bank.product_offset(p)*stride;
+      for (unsigned k=0; k<n; ++k) add_windows(b+f[k]*stride, w+k*nw, nw);
+      if (!nb) continue;
+      b = boot + vars.bank.product_offset(p)*nb;
+      for (unsigned k=0; k<n; ++k) add_replicas(b+f[k]*nb, bw+k*nb, nb);
+    }
+    const Int_t *njets = block.njets.data();
+    for (unsigned k=0; k<n; ++k) {
+      if (njets[k] == 0) add_windows(acc.nj0.data(), w+k*nw, nw);
+      if (njets[k]  < 2) add_windows(acc.njless2.data(), w+k*nw, nw);
+    }
+    for (unsigned k=0; k<n && nb; ++k) {
+      if (njets[k] == 0) add_replicas(acc.boot_nj0.data(), bw+k*nb, nb);
+      if (njets[k]  < 2) add_replicas(acc.boot_njless2.data(), bw+k*nb, nb);
+    }
+
+    block.clear();
+  }
+};
+
+// Blocks are filled on a separate thread, so that reading and
+// decompression overlap with binning.
+// The reading thread takes empty blocks from a fixed pool and passes
+// full ones through a bounded lock-free queue. Once all blocks are in
+// flight it waits for the filling thread to return one, so memory use
+// is bounded by the pool size.
+// Blocks of a reading thread are filled in order, so the sums are the
+// same as without the pipeline.
+// Either thread sleeps when it has to wait for more than a short time,
+// so a stalled reader does not keep its filling thread busy.
+class block_pipeline {
+  vector<unique_ptr<event_block>> pool;
+  spsc_queue<event_block*> full, empty;
+  atomic<unsigned> queued; // blocks put and not yet filled
+  atomic<bool> done;
+  parking filled, freed; // waits of the filling and the reading thread
+  stage_time *wait_prof; // wait stage of the reading thread
+  block_binner binner;
+  thread filler;
+
+  void run() {
+    event_block *block;
+    for (;;) {
+      bool got = false;
+      filled.wait([&]{
+        return (got = full.pop(block)) || done.load(memory_order_acquire);
+      });
+      if (got) {
+        binner(*block);
+        empty.push(block);
+        queued.fetch_sub(1, memory_order_release);
+        freed.notify();
+      } else if (full.empty()) break;
+    }
+  }
+
+public:
+  // prof is the row of the filling thread, reader_prof of the reading one
+  block_pipeline(const var_set& vars, unsigned nblocks, stage_time* prof,
+                 stage_time* reader_prof)
+  : full(nblocks), empty(nblocks), queued(0), done(false),
+    wait_prof(at(reader_prof,stage::wait)), binner(vars,prof) {
+    for (unsigned i=0; i<nblocks; ++i) {
+      pool.emplace_back(new event_block(vars));
+      empty.push(pool.back().get());
+    }
+    filler = thread(&block_pipeline::run, this);
+  }
+  block_pipeline(const block_pipeline&) = delete;
+  ~block_pipeline() {
+    done.store(true, memory_order_release);
+    filled.notify();
+    filler.join();
+  }
+
+  event_block* get() {
+    event_block *block;
+    if (empty.pop(block)) return block;
+    scoped_timer tm(wait_prof);
+    freed.wait([&]{ return empty.pop(block); });
+    return block;
+  }
+
+  // cannot fail, since there are only as many blocks as queue slots;
+  // empty blocks are just returned to the pool
+  void put(event_block* block) {
+    queued.fetch_add(1, memory_order_relaxed);
+    full.push(block);
+    filled.notify();
+  }
+
+  // wait until all blocks put so far are filled
+  void wait() {
+    scoped_timer tm(wait_prof);
+    freed.wait([this]{ return !queued.load(memory_order_acquire); });
+  }
+};
+
+// Selected events are buffered in blocks and filled block by block,
+// either right away or, with a pipeline, on its filling thread.
+class block_filler {
+  const var_set& vars;
+  const size_t njets_b; // branch of N_j_30
+  block_pipeline *pipe;
+  unique_ptr<block_binner> binner;
+  unique_ptr<event_block> own;
+  event_block *block;
+
+public:
+  block_filler(const var_set& vars, block_pipeline* pipe, stage_time* prof)
+  : vars(vars), njets_b(vars.branch(vars.njets_i)), pipe(pipe) {
+    if (pipe) block = pipe->get();
+    else {
+      binner.reset(new block_binner(vars,prof));
+      own.reset(new event_block(vars));
+      block = own.get();
+    }
+  }
+  block_filler(const block_filler&) = delete;
+  ~block_filler() { if (pipe) pipe->put(block); }
+
+  // x(b) returns the raw value of branch b of the variables,
+  // bit j of mask is set if the event counts for window j,
+  // key is the event_key() of the event
+  template <typename X>
+  inline void push(Float_t w, unsigned mask, uint64_t key, X&& x,
+                   accum& acc) {
+    for (unsigned j=0, nw=windows.size(); j<nw; ++j)
+      block->w.push_back((mask>>j & 1u) ? w : 0.f);
+    if (bootstrap.n) block->key.push_back(key);
+    for (size_t b=0; b<block->x.size(); ++b) block->x[b].push_back(x(b));
+    block->njets.push_back(block->x[njets_b].back().i);
+    if (block->size() == event_block::size_max) flush(acc);
+  }
+
+  void flush(accum& acc) {
+    if (!block->size()) return;
+    block->acc = &acc;
+    if (pipe) {
+      pipe->put(block);
+      block = pipe->get();
+    } else (*binner)(*block);
+  }
+};
+
+// I/O of one thread, summed over the files it read
+struct io_stats {
+  Long64_t bytes, calls;
+  double unzip;
+  io_stats(): bytes(0), calls(0), unzip(0) { }
+  io_stats& operator+=(const io_stats& o) noexcept {
+    bytes += o.bytes;
+    calls += o.calls;
+    unzip += o.unzip;
+    return *this;
+  }
+};
+
+// TFile and TTree handle with its own branch addresses.
+// A thread keeps a reader open for as long as it processes ranges
+// of the same file.
+class reader {
+  unique_ptr<TFile> file;
+  TTree *tree;
+  Char_t isPassed;
+  Float_t cs_br_fe, weight, m_yy;
+  vector<var_value> xs;
+  vector<const var_value*> x; // branches of the variables, m_yy is shared
+  block_filler filler;
+  io_stats& stats;
+  unique_ptr<TTreePerfStats> perf;
+  // Selection branches are read first, the rest only for
+  // selected events, so rejected events are not decompressed
+  TBranch *b_isPassed, *b_m_yy;
+  vector<TBranch*> b_rest;
+  stage_time *prof;
+
+  TBranch* get_branch(const string& name) {
+    TBranch *b = tree->GetBranch(name.c_str());
+    if (!b) throw runtime_error("no branch "+name+" in "+file->GetName());
+    return b;
+  }
+
+  // Types of branches of the variables are declared in the bins file
+  // and the values are read as such, so they have to match
+  void check_type(const string& name, bool is_int) {
+    const TObjArray *leaves = get_branch(name)->GetListOfLeaves();
+    const string type = leaves->GetEntries()
+      ? static_cast<const TLeaf*>(leaves->At(0))->GetTypeName() : "";
+    if (type != (is_int ? "Int_t" : "Float_t"))
+      throw runtime_error(name+" is "+type+" in "+file->GetName()
+        +", but is declared "+(is_int ? "int" : "float"));
+  }
+
+  // Events passing the preselection are copied to out if it is not null
+  template <sample S>
+  void loop(const task& t, accum& acc, skim::table* out, progress* prog) {
+    if (io.cache > 0) tree->SetCacheEntryRange(t.first,t.last);
+    const Long64_t bytes = file->GetBytesRead();
+    select_timer st(prof);
+    for (timed_counter<Long64_t> ent(t.first,t.last,prog,
+           [this,bytes]{ return file->GetBytesRead() - bytes; });
+         ent.ok(); ++ent) {
+      Long64_t local;
+      {
+        scoped_timer tm(at(prof,stage::read));
+        local = tree->LoadTree(ent);
+        b_isPassed->GetEntry(local);
+      }
+      if (!isPassed) continue;
+      {
+        scoped_timer tm(at(prof,stage::read));
+        b_m_yy->GetEntry(local);
+      }
+      if (!in(m_yy,windows.range())) continue;
+      const unsigned mask = windows.mask<S>(m_yy);
+      if (!out && !mask) continue;
+
+      {
+        scoped_timer tm(at(prof,stage::read));
+        for (TBranch *b : b_rest) b->GetEntry(local);
+      }
+
+      if (out) {
+        out->cols[0].push_back({weight});
+        out->cols[1].push_back({S==sample::mc ? cs_br_fe : 0.f});
+        out->cols[2].push_back({m_yy});
+        const var_value *m = reinterpret_cast<const var_value*>(&m_yy);
+        for (size_t b=0, c=3; b<x.size(); ++b)
+          if (x[b]!=m) out->cols[c++].push_back({x[b]->f});
+      }
+
+      if (!mask) continue;
+
+      if (S==sample::mc) {
+        weight *= cs_br_fe*lumi.in;
+      }
+
+      filler.push(weight, mask, event_key(fkey,ent),
+                  [this](size_t b){ return *x[b]; }, acc);
+    }
+    filler.flush(acc);
+  }
+
+public:
+  const size_t file_i;
+  const bool mc_file;
+  const uint64_t fkey;
+
+  reader(const input_file& input, size_t file_i, const var_set& vars,
+         io_stats& stats, block_pipeline* pipe, stage_time* prof)
+  : file(open_file(input.name,prof)), tree(get_tree(file.get())),
+    xs(vars.branches.size()), x(xs.size()),
+    filler(vars,pipe,prof), stats(stats), prof(prof),
+    file_i(file_i), mc_file(input.mc), fkey(file_key(input.name))
+  {
+
+    branches(tree,
+      "HGamEventInfoAuxDyn.weight",   &weight,
+      "HGamEventInfoAuxDyn.isPassed", &isPassed,
+      "HGamEventInfoAuxDyn.m_yy",     &m_yy
+    );
+    vector<string> active {
+      "HGamEventInfoAuxDyn.weight",
+      "HGamEventInfoAuxDyn.isPassed",
+      "HGamEventInfoAuxDyn.m_yy"
+    };
+
+    if (mc_file) {
+      active.emplace_back("HGamEventInfoAuxDyn.crossSectionBRfilterEff");
+      branches_set_on(tree, active.back().c_str(), &cs_br_fe);
     }
-    name = tok.front();
-    vector<double> edges(tok.size()-1);
-    for (unsigned i=1; i<tok.size(); ++i)
-      edges[i-1] = std::stod(tok[i]);
-    bins.init(edges.begin(),edges.end());
 
-    take_abs = in(name,"Dphi_j_j","cosTS_yy","Dy_j_j");
+    for (size_t b=0; b<xs.size(); ++b) {
+      const expr_branch& br = vars.branches[b];
+      if (br.name=="m_yy") {
+        x[b] = reinterpret_cast<const var_value*>(&m_yy);
+        continue;
+      }
+      active.push_back("HGamEventInfoAuxDyn."+br.name);
+      check_type(active.back(), br.is_int);
+      branches_set_on(tree, active.back().c_str(),
+        reinterpret_cast<void*>(&xs[b]));
+      x[b] = &xs[b];
+    }
+
+    b_isPassed = get_branch(active[1]);
+    b_m_yy = get_branch(active[2]);
+    b_rest.push_back(get_branch(active[0]));
+    for (size_t i=3; i<active.size(); ++i)
+      b_rest.push_back(get_branch(active[i]));
+
+    branches_cache(tree, Long64_t(io.cache*(1<<20)), active, io.prefetch);
+    if (io.stats) perf.reset(new TTreePerfStats("ioperf",tree));
+  }
+  reader(const reader&) = delete;
+  ~reader() {
+    stats.bytes += file->GetBytesRead();
+    stats.calls += file->GetReadCalls();
+    if (perf) stats.unzip += perf->GetUnzipTime();
+    file->Close();
   }
 
-  double signif(unsigned i) {
-    return bins[i].signif();
+  // Progress is added to prog if it is not null, otherwise printed
+  void loop(const task& t, accum& acc, skim::table* out, progress* prog) {
+    if (mc_file) loop<sample::mc  >(t,acc,out,prog);
+    else         loop<sample::data>(t,acc,out,prog);
   }
+};
 
-  void merge(double n) {
-    for (auto& b : bins.bins()) b.merge(n);
+// Reads events straight from the columns of a mapped skim file
+class skim_reader {
+  const skim::file::entry& entry;
+  const skim::value *w, *cs, *m;
+  vector<const var_value*> xs;
+  block_filler filler;
+  stage_time *prof;
+
+  template <sample S>
+  void loop(const task& t, accum& acc, progress* prog) {
+    select_timer st(prof);
+    for (timed_counter<Long64_t> ent(t.first,t.last,prog); ent.ok(); ++ent) {
+      const Long64_t k = ent;
+      const unsigned mask = windows.mask<S>(m[k].f);
+      if (!mask) continue;
+
+      Float_t weight = w[k].f;
+      if (S==sample::mc) {
+        weight *= cs[k].f*lumi.in;
+      }
+
+      filler.push(weight, mask, event_key(fkey,k),
+                  [this,k](size_t b){ return xs[b][k]; }, acc);
+    }
+    filler.flush(acc);
+  }
+
+public:
+  const size_t file_i;
+  const bool mc_file;
+  const uint64_t fkey;
+
+  skim_reader(const skim::file& sk, size_t file_i, const var_set& vars,
+              block_pipeline* pipe, stage_time* prof)
+  : entry(sk.entries().at(file_i)),
+    w (entry.cols[sk.column_index("weight",false)]),
+    cs(entry.cols[sk.column_index("crossSectionBRfilterEff",false)]),
+    m (entry.cols[sk.column_index("m_yy",false)]),
+    filler(vars,pipe,prof), prof(prof), file_i(file_i), mc_file(entry.mc),
+    fkey(file_key(entry.name))
+  {
+    static_assert(sizeof(skim::value)==sizeof(var_value),
+      "skim values and branch values must have the same size");
+    for (const auto& b : vars.branches)
+      xs.push_back(reinterpret_cast<const var_value*>(
+        entry.cols[sk.column_index(b.name,b.is_int)]));
+  }
+
+  void loop(const task& t, accum& acc, progress* prog) {
+    if (mc_file) loop<sample::mc  >(t,acc,prog);
+    else         loop<sample::data>(t,acc,prog);
   }
 };
 
 int main(int argc, char* argv[])
 {
   vector<string> ifname_data, ifname_mc;
-  string ofname, cfname, ifname_bins;
+  string cfname, skim_in, skim_out, norm_cache_fname, ckpt_dir, shard_out;
+  settings set;
+  unsigned njobs, nblocks;
+  Long64_t chunk;
 
   // options ---------------------------------------------------
   try {
     po::options_description desc("Options");
     desc.add_options()
-      ("data", po::value(&ifname_data)->multitoken()->required(),
+      ("data", po::value(&ifname_data)->multitoken(),
        "input root data files")
-      ("mc", po::value(&ifname_mc)->multitoken()->required(),
+      ("mc", po::value(&ifname_mc)->multitoken(),
        "input root Monte Carlo files")
-      ("output,o", po::value(&ofname)->required(),
-       "output root file")
       ("conf,c", po::value(&cfname),
        "configuration file")
-      ("bins,b", po::value(&ifname_bins)->required(),
-       "differential variables bins")
-      ("lumi.in", po::value(&lumi.in)->default_value(3245.),
-       "configuration file")
-      ("lumi.need,l", po::value(&lumi.need)->default_value(6000.),
-       "configuration file")
+    ;
+    add_options(desc,set);
+    desc.add_options()
+      ("shard", po::value(&shard_out),
+       "write sums of the input files to this file for\n"
+       "signif-merge instead of the output")
+      ("jobs,j", po::value(&njobs)->default_value(1),
+       "number of parallel threads")
+      ("chunk", po::value(&chunk)->default_value(100000),
+       "minimum number of entries per task")
+      ("pipeline", po::value(&nblocks)->default_value(0),
+       "fill on a separate thread per job, with this many\n"
+       "blocks of events in flight, 0 to fill while reading")
+      ("write-skim", po::value(&skim_out),
+       "write preselected events, with m_yy in the range of the windows,"
+       " to a skim file")
+      ("read-skim", po::value(&skim_in),
+       "read events from a skim file instead of the root files")
+      ("checkpoint", po::value(&ckpt_dir),
+       "directory of sums of processed input files,\n"
+       "which are not processed again if unchanged;\n"
+       "files that cannot be stat'ed, e.g. root:// URLs,\n"
+       "are always processed")
+      ("norm-cache", po::value(&norm_cache_fname),
+       "cache of MC normalisations and tree clusters of the input\n"
+       "files, keyed by path, size and modification time;\n"
+       "files that cannot be stat'ed, e.g. root:// URLs,\n"
+       "are not cached")
+      ("io.cache", po::value(&io.cache)->default_value(32.),
+       "tree cache size in MB, 0 to disable")
+      ("io.prefetch", po::bool_switch(&io.prefetch),
+       "asynchronous prefetch of the cached branches")
+      ("io.stats", po::bool_switch(&io.stats),
+       "print bytes read, read calls and decompression time")
     ;
 
     po::positional_options_description pos;
@@ -147,6 +740,17 @@ int main(int argc, char* argv[])
         vm["conf"].as<string>().c_str(), desc), vm);
     }
     po::notify(vm);
+
+    if (set.ofname.empty() && shard_out.empty())
+      throw po::error("output or shard file is required");
+    if (skim_in.empty() && (ifname_data.empty() || ifname_mc.empty()))
+      throw po::error("data and mc files are required without --read-skim");
+    if (!skim_in.empty() && !skim_out.empty())
+      throw po::error("--read-skim and --write-skim are exclusive");
+    if (!ckpt_dir.empty() && !(skim_in.empty() && skim_out.empty()))
+      throw po::error("--checkpoint cannot be used with skims");
+
+    apply_options(set);
   } catch (exception& e) {
     cerr << "\033[31m" << argv[0]
          << " options: " <<  e.what() <<"\033[0m"<< endl;
@@ -154,182 +758,279 @@ int main(int argc, char* argv[])
   }
   // end options ---------------------------------------------------
 
-  vector<pair<const string*,bool>> ifname;
-  for (const auto& f : ifname_data) ifname.emplace_back(&f,false);
-  for (const auto& f : ifname_mc  ) ifname.emplace_back(&f,true );
+  const auto wall_start = chrono::steady_clock::now();
 
-  lumi.fac = sqrt(lumi.need/lumi.in);
+  // row 0 is the main thread, followed by the jobs
+  // and their pipeline threads
+  unique_ptr<stage_profile> profile;
+  if (set.prof_print || !set.prof_json.empty())
+    profile.reset(new stage_profile(stage::names,1));
+  auto prof_row = [&](unsigned i) -> stage_time* {
+    return profile ? profile->row(i) : nullptr;
+  };
 
-  bkg_sig inclusive, nj0, njless2;
-  vector<unique_ptr<var>> vars;
+  vector<input_file> inputs;
+  if (skim_in.empty()) {
+    for (const auto& f : ifname_data) inputs.emplace_back(f,false);
+    for (const auto& f : ifname_mc  ) inputs.emplace_back(f,true );
+  }
 
-  ifstream binsf(ifname_bins);
-  if (binsf.is_open()) {
-    string line;
-    while ( getline(binsf,line) ) {
-      // cout << line << '\n';
-      if (line.size()==0 || line[0]=='#') continue;
-      vars.emplace_back(new var(line));
-    }
-    binsf.close();
-  } else {
-    cout << "Unable to open " << ifname_bins << endl;
+  binnings bins;
+  try {
+    bins = read_binnings(set);
+  } catch (exception& e) {
+    cerr << "\033[31m" << e.what() <<"\033[0m"<< endl;
     return 1;
   }
+  const var_set& vars = bins.vars;
+  for (const auto& b : vars.branches)
+    if (in(b.name,"isPassed","weight","crossSectionBRfilterEff")) {
+      cerr << "\033[31m" << b.name << " is a selection branch"
+              " and cannot be used in variables\033[0m" << endl;
+      return 1;
+    }
 
-  Char_t isPassed;
-  Float_t cs_br_fe, weight, m_yy;
-  Int_t *njets = nullptr;
-
-  for (const auto& f : ifname) {
-    TFile* file = new TFile(f.first->c_str(),"read");
-    if (file->IsZombie()) return 1;
-
-    mc_file = f.second;
-
-    cout << ( mc_file ? "MC:" : "Data:" ) << ' '
-         << file->GetName() << endl;
+  if (njobs < 1) njobs = 1;
 
-    double n_all = 1;
-    if (mc_file) {
-      TIter next(file->GetListOfKeys());
-      TKey *key;
-      while ((key = static_cast<TKey*>(next()))) {
-        string name(key->GetName());
-        if (name.substr(0,8)!="CutFlow_" ||
-            name.substr(name.size()-18)!="_noDalitz_weighted") continue;
-        TH1 *h = static_cast<TH1*>(key->ReadObj());
-        cout << h->GetName() << endl;
-        n_all = h->GetBinContent(3);
-        cout << h->GetXaxis()->GetBinLabel(3) << " = " << n_all << endl;
-        break;
+  // Each task is a cluster-aligned range of entries of one file
+  // and has its own accumulators.
+  // Threads balance the load by stealing tasks from each other;
+  // results are summed per file in task order, and the tasks are the
+  // same for any number of jobs, so the output does not depend on it.
+  vector<task> tasks;
+  unique_ptr<skim::file> skim_file;
+  try {
+    if (skim_in.empty()) {
+      unique_ptr<norm_cache> cache;
+      if (!norm_cache_fname.empty())
+        cache.reset(new norm_cache(norm_cache_fname));
+      plan(inputs, chunk, tasks, cache.get(), prof_row(0));
+      if (cache) cache->save();
+    } else {
+      skim_file.reset(new skim::file(skim_in));
+      const auto r = skim_file->m_yy_range(), w = windows.range();
+      if (w.first < r.first || r.second < w.second) {
+        ostringstream ss;
+        ss << "skim " << skim_in << " has events with m_yy in ("
+           << r.first << ',' << r.second << "), which does not contain"
+              " the range of the windows (" << w.first << ',' << w.second
+           << ')';
+        throw runtime_error(ss.str());
       }
+      plan(*skim_file, chunk, inputs, tasks);
     }
+  } catch (exception& e) {
+    cerr << "\033[31m" << e.what() <<"\033[0m"<< endl;
+    return 1;
+  }
 
-    TTree* tree = (TTree*)file->Get("CollectionTree");
+  // Sums of files with a checkpoint are read back,
+  // and only the other files are processed
+  vector<accum> file_sums(inputs.size(), accum(vars));
+  const string config = sums_config(vars);
+  unique_ptr<checkpoints> ckpt;
+  if (!ckpt_dir.empty()) {
+    vector<bool> done(inputs.size(),false);
+    try {
+      ckpt.reset(new checkpoints(ckpt_dir));
+      for (size_t f=0; f<inputs.size(); ++f) {
+        if (file_id(inputs[f].name).empty()) {
+          cerr << "\033[33m" << inputs[f].name << " cannot be stat'ed"
+                  " and is not checkpointed\033[0m" << endl;
+          continue;
+        }
+        if (ckpt->read(inputs[f].name, inputs[f].mc, config,
+                       file_sums[f].arrays())) {
+          done[f] = true;
+          cout << "Checkpoint: " << inputs[f].name << endl;
+        } else file_sums[f] = accum(vars);
+      }
+    } catch (exception& e) {
+      cerr << "\033[31m" << e.what() <<"\033[0m"<< endl;
+      return 1;
+    }
+    tasks.erase(remove_if(tasks.begin(),tasks.end(),
+      [&](const task& tk){ return done[tk.file]; }), tasks.end());
+  }
 
-    branches(tree,
-      "HGamEventInfoAuxDyn.weight",   &weight,
-      "HGamEventInfoAuxDyn.isPassed", &isPassed,
-      "HGamEventInfoAuxDyn.m_yy",     &m_yy
-    );
+  if (njobs > tasks.size()) njobs = max<size_t>(tasks.size(),1);
+  if (profile) profile->resize(1+2*njobs);
 
-    if (mc_file) branches_set_on(tree,
-      "HGamEventInfoAuxDyn.crossSectionBRfilterEff", &cs_br_fe);
+  vector<accum> results(tasks.size(), accum(vars));
 
-    for (auto& v : vars) {
-      branches_set_on(tree,
-        ("HGamEventInfoAuxDyn."+v->name).c_str(),
-        reinterpret_cast<void*>(&(v->_x))
-      );
-      if (v->name=="N_j_30") {
-        njets = &v->_x.i;
-      }
+  // With checkpoints, a file is summed and saved by the thread
+  // that finishes its last task
+  vector<atomic<unsigned>> remaining(inputs.size());
+  for (const auto& tk : tasks) ++remaining[tk.file];
+  auto finish_file = [&](size_t f) {
+    for (size_t t=0; t<tasks.size(); ++t)
+      if (tasks[t].file==f) file_sums[f] += results[t];
+    if (ckpt) {
+      const accum& sums = file_sums[f];
+      ckpt->write(inputs[f].name, inputs[f].mc, config, sums.arrays());
     }
+  };
 
-    if (!njets) {
-      cerr << "N_j_30 branch was not used" << endl;
-      return 1;
-    }
+  const vector<skim::column> skim_cols = skim_columns(vars);
+  vector<skim::table> skim_tables;
+  if (!skim_out.empty())
+    skim_tables.assign(tasks.size(), skim::table(skim_cols.size()));
 
-    for (timed_counter<Long64_t> ent(tree->GetEntries()); ent.ok(); ++ent) {
-      tree->GetEntry(ent);
+  work_stealing<size_t> pool(njobs);
+  {
+    vector<size_t> ids(tasks.size());
+    for (size_t i=0; i<ids.size(); ++i) ids[i] = i;
+    pool.distribute(ids.begin(),ids.end());
+  }
+  vector<exception_ptr> errors(njobs);
+  vector<io_stats> stats(njobs);
 
-      if (!isPassed) continue;
-      if (!in(m_yy,mass_range)) continue;
+  Long64_t nent = 0;
+  vector<Long64_t> file_nent(inputs.size(),0);
+  for (const auto& tk : tasks) {
+    nent += tk.last - tk.first;
+    file_nent[tk.file] += tk.last - tk.first;
+  }
 
-      if (mc_file) {
-        weight *= cs_br_fe*lumi.in;
-      }
+  // parallel jobs report to one progress line;
+  // one job takes the tasks in order and reports every file on its own
+  const bool per_file = (njobs == 1);
+  unique_ptr<progress> prog;
+  if (!per_file) prog.reset(new progress(nent));
 
-      inclusive(m_yy,weight);
-      for (auto& v : vars) {
-        v->bins.fill(v->x(),m_yy,weight);
+  auto worker = [&](unsigned tid) {
+    try {
+      // declared first, so that readers return their blocks before
+      // the pipeline is stopped
+      unique_ptr<block_pipeline> pipe;
+      if (nblocks)
+        pipe.reset(new block_pipeline(vars,nblocks,prof_row(1+njobs+tid),
+                                      prof_row(1+tid)));
+      unique_ptr<reader> r;
+      unique_ptr<skim_reader> sr;
+      for (size_t t; pool.pop(tid,t); ) {
+        const task& tk = tasks[t];
+        if (per_file && (t==0 || tasks[t-1].file!=tk.file)) {
+          prog.reset();
+          prog.reset(new progress(file_nent[tk.file]));
+        }
+        if (skim_file) {
+          if (!sr || sr->file_i != tk.file) {
+            sr.reset();
+            sr.reset(new skim_reader(*skim_file,tk.file,vars,pipe.get(),
+                                     prof_row(1+tid)));
+          }
+          sr->loop(tk,results[t],prog.get());
+        } else {
+          if (!r || r->file_i != tk.file) {
+            r.reset();
+            r.reset(new reader(inputs[tk.file],tk.file,vars,stats[tid],
+                               pipe.get(),prof_row(1+tid)));
+          }
+          skim::table *out = skim_tables.empty() ? nullptr : &skim_tables[t];
+          r->loop(tk,results[t],out,prog.get());
+        }
+        if (ckpt) {
+          // blocks of the task may still be in the pipeline
+          if (pipe) pipe->wait();
+          if (--remaining[tk.file] == 0) finish_file(tk.file);
+        }
       }
-      if ((*njets) == 0) nj0(m_yy,weight);
-      if ((*njets)  < 2) njless2(m_yy,weight);
+    } catch (...) {
+      errors[tid] = current_exception();
+      pool.clear();
     }
+  };
 
-    inclusive.merge(n_all);
-    nj0.merge(n_all);
-    njless2.merge(n_all);
-    for (auto& v : vars) v->merge(n_all);
+  const auto loop_start = chrono::steady_clock::now();
+  const clock_t cpu_start = clock();
 
-    file->Close();
-    delete file;
+  if (njobs == 1) worker(0);
+  else {
+    ROOT::EnableThreadSafety();
+    vector<thread> threads;
+    threads.reserve(njobs);
+    for (unsigned i=0; i<njobs; ++i) threads.emplace_back(worker,i);
+    for (auto& th : threads) th.join();
   }
+  prog.reset();
 
-  cout << "============" << endl;
-  test(factor)
-  cout << "Inclusive" << endl;
-  cout << "Signal: " << inclusive.sig << endl;
-  cout << "Bkg under signal: " << factor * inclusive.bkg << endl;
-  cout << "Bkg in sidebands: " << inclusive.bkg << endl;
-  cout << "Significance: " << inclusive.signif() << endl;
-  cout << "============" << endl;
-
-  TFile* file = new TFile(ofname.c_str(),"recreate");
+  for (auto& e : errors) if (e) {
+    try { rethrow_exception(e); }
+    catch (exception& e) {
+      cerr << "\033[31m" << e.what() <<"\033[0m"<< endl;
+      return 1;
+    }
+  }
 
-  vector<TH1*> hists;
-  hists.reserve(vars.size());
+  // The loop is CPU-bound if the CPU time is close to njobs times
+  // the real time, and decompression is only a part of it
+  if (io.stats) {
+    const double real = chrono::duration<double>(
+      chrono::steady_clock::now() - loop_start).count();
+    const double cpu = double(clock() - cpu_start)/CLOCKS_PER_SEC;
+    io_stats total;
+    for (const auto& st : stats) total += st;
+    cout << "I/O: " << total.bytes/1e6 << " MB in "
+         << total.calls << " read calls";
+    if (total.calls) cout << " (" << total.bytes/1e3/total.calls << " kB/call)";
+    cout << endl
+         << "I/O: decompression " << total.unzip << " s, loop "
+         << real << " s real, " << cpu << " s CPU ("
+         << 100.*cpu/(real*njobs) << "% of " << njobs << " threads)"
+         << endl;
+  }
 
-  for (const auto& v : vars) {
-    std::vector<double>& edges = v->bins.edges();
-    if ( std::isinf(edges.back()) ) {
-      edges.back() = edges[edges.size()-2] + (edges[1] - edges[0]);
-    }
-    if ( (v->name[0]=='p' && v->name[1]=='T')
-      || (v->name[0]=='m' && v->name[1]=='_') ) {
-      for (auto& e : edges) e /= 1e3;
+  if (!skim_out.empty()) {
+    // ranges of the same file are its parts, in task order
+    vector<skim::file_parts> files;
+    for (const auto& input : inputs)
+      files.push_back({input.name,input.mc,input.n_all,{}});
+    for (size_t t=0; t<tasks.size(); ++t)
+      files[tasks[t].file].parts.push_back(&skim_tables[t]);
+    try {
+      scoped_timer tm(at(prof_row(0),stage::write));
+      skim::write(skim_out, windows.range(), skim_cols, files);
+      skim_tables.clear();
+    } catch (exception& e) {
+      cerr << "\033[31m" << e.what() <<"\033[0m"<< endl;
+      return 1;
     }
+    cout << "Wrote skim " << skim_out << endl;
+  }
 
-    const unsigned n = v->bins.nbins();
-    TH1 *h = new TH1D(v->name.c_str(),"",n,v->bins.edges().data());
-    hists.push_back(h);
-
-    cout << v->name << endl;
-    unsigned bin = 1;
-    if ( v->name.substr(v->name.size()-4)=="_j_j"
-      || v->name.substr(v->name.size()-3)=="_jj"
-    ) {
-      h->SetBinContent(bin++,njless2.signif());
-    } else if ( v->name.substr(v->name.size()-3)=="_j1" ) {
-      h->SetBinContent(bin++,nj0.signif());
-    }
+  {
+    scoped_timer tm(at(prof_row(0),stage::merge));
+    if (!ckpt) for (size_t f=0; f<inputs.size(); ++f) finish_file(f);
+    results.clear();
+  }
 
-    const unsigned w = log10(v->bins.edges().back())+1;
-    for (; bin<=n; ++bin) {
-      cout <<'['<<setw(w)<< v->bins.ledge(bin)
-           <<','<<setw(w)<< v->bins.redge(bin) <<"): "
-           << v->bins[bin].sig << "  "
-           << v->bins[bin].bkg << "  ";
+  if (!shard_out.empty()) {
+    try {
+      scoped_timer tm(at(prof_row(0),stage::write));
+      write_shard(shard_out, config, inputs, file_sums);
+    } catch (exception& e) {
+      cerr << "\033[31m" << e.what() <<"\033[0m"<< endl;
+      return 1;
+    }
+    cout << "Wrote shard " << shard_out << endl;
+  } else if (int status = finish(set, bins, inputs, file_sums, prof_row(0)))
+    return status;
 
-      double signif = v->signif(bin);
-      cout << signif << endl;
-      h->SetBinContent(bin,signif);
+  if (profile) {
+    const double wall = chrono::duration<double>(
+      chrono::steady_clock::now() - wall_start).count();
+    if (set.prof_print) {
+      cout << "============" << endl;
+      profile->print(cout,wall);
     }
-    cout << endl;
-
-    TAxis *xa = h->GetXaxis();
-    if (v->name[0]=='N') {
-      for (unsigned i=1; ; ++i) {
-        stringstream ss;
-        if (n-i) {
-          ss << " = " << i-1;
-          xa->SetBinLabel(i,ss.str().c_str());
-        } else {
-          ss << " #geq " << i-1;
-          xa->SetBinLabel(i,ss.str().c_str());
-          break;
-        }
-      }
-      xa->SetLabelSize(0.05);
+    if (!set.prof_json.empty()) {
+      ofstream f(set.prof_json);
+      ostringstream extra;
+      extra << "\"jobs\": " << njobs << ",\n  \"events\": " << nent;
+      profile->write_json(f,wall,extra.str());
     }
   }
 
-  file->Write();
-  file->Close();
-  delete file;
-
   return 0;
 }
@@ -0,0 +1,266 @@
+#ifndef signif_skim_hh
+#define signif_skim_hh
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Compact columnar file of preselected events.
+ *
+ * Every column holds one 4-byte value per event, float or int as
+ * recorded in the header, so that it is read with the type it was
+ * written with.
+ * Events of each input file are stored as contiguous columns, each
+ * starting at a 64-byte aligned offset, so that a mapped file can be
+ * read as plain arrays without any decoding.
+ * The m_yy range of the preselection is stored, so that a skim is not
+ * read with mass windows outside of it.
+ *
+ * Layout (native byte order):
+ *   "SIGSKIM3"
+ *   f64 m_yy_min, f64 m_yy_max
+ *   u32 ncols, u32 nfiles
+ *   ncols  x { u32 len, char name[len], u8 is_int }
+ *   nfiles x { u32 len, char name[len], u8 mc, f64 n_all,
+ *              u64 nevents, u64 offset }
+ *   column data
+ */
+
+namespace skim {
+
+union value { float f; int32_t i; };
+
+struct column {
+  std::string name;
+  bool is_int;
+};
+
+// Columns of a part of the events of an input file
+struct table {
+  std::vector<std::vector<value>> cols;
+
+  table(size_t ncols): cols(ncols) { }
+
+  inline size_t size() const noexcept {
+    return cols.empty() ? 0 : cols.front().size();
+  }
+};
+
+// Events of an input file are the concatenation of its parts,
+// e.g. the ranges of entries read by separate tasks
+struct file_parts {
+  std::string name;
+  bool mc;
+  double n_all;
+  std::vector<table*> parts;
+
+  size_t size() const noexcept {
+    size_t n = 0;
+    for (const table *t : parts) n += t->size();
+    return n;
+  }
+};
+
+constexpr char magic[8] = {'S','I','G','S','K','I','M','3'};
+constexpr uint64_t align = 64;
+
+namespace detail {
+
+template <typename T>
+inline void put(std::string& buf, const T& x) {
+  buf.append(reinterpret_cast<const char*>(&x), sizeof(T));
+}
+inline void put(std::string& buf, const std::string& s) {
+  put(buf, uint32_t(s.size()));
+  buf += s;
+}
+inline uint64_t aligned(uint64_t n) noexcept {
+  return (n + align-1) & ~(align-1);
+}
+
+}
+
+// Columns of the parts are written straight from their tables and
+// released as soon as they are written, so events are not copied
+// and memory is freed while writing.
+inline void write(const std::string& fname,
+                  std::pair<double,double> m_yy_range,
+                  const std::vector<column>& columns,
+                  const std::vector<file_parts>& files) {
+  using namespace detail;
+
+  // header size does not depend on offsets, so compute it first
+  std::string head(magic, sizeof(magic));
+  put(head, m_yy_range.first);
+  put(head, m_yy_range.second);
+  put(head, uint32_t(columns.size()));
+  put(head, uint32_t(files.size()));
+  for (const auto& c : columns) {
+    put(head, c.name);
+    put(head, uint8_t(c.is_int));
+  }
+  size_t head_size = head.size();
+  for (const auto& fp : files)
+    head_size += 4 + fp.name.size() + 1 + 8 + 8 + 8;
+
+  uint64_t offset = aligned(head_size);
+  for (const auto& fp : files) {
+    for (const table *t : fp.parts)
+      if (t->cols.size() != columns.size())
+        throw std::runtime_error("skim: wrong number of columns for "
+                                 +fp.name);
+    const size_t n = fp.size();
+    put(head, fp.name);
+    put(head, uint8_t(fp.mc));
+    put(head, fp.n_all);
+    put(head, uint64_t(n));
+    put(head, offset);
+    offset += columns.size() * aligned(n*sizeof(value));
+  }
+
+  std::ofstream f(fname, std::ios::binary);
+  if (!f) throw std::runtime_error("skim: cannot write "+fname);
+  const std::string pad(align, '\0');
+  f.write(head.data(), head.size());
+  f.write(pad.data(), aligned(head.size()) - head.size());
+  for (const auto& fp : files) {
+    const size_t n = fp.size()*sizeof(value);
+    for (size_t c=0; c<columns.size(); ++c) {
+      for (table *t : fp.parts) {
+        std::vector<value>& col = t->cols[c];
+        f.write(reinterpret_cast<const char*>(col.data()),
+                col.size()*sizeof(value));
+        std::vector<value>().swap(col);
+      }
+      f.write(pad.data(), aligned(n) - n);
+    }
+  }
+  if (!f) throw std::runtime_error("skim: error writing "+fname);
+}
+
+// Read-only memory-mapped skim file
+class file {
+public:
+  struct entry {
+    std::string name;
+    bool mc;
+    double n_all;
+    uint64_t nevents;
+    std::vector<const value*> cols;
+  };
+
+private:
+  void *_data;
+  size_t _size;
+  std::pair<double,double> _m_yy_range;
+  std::vector<column> _columns;
+  std::vector<entry> _entries;
+
+  struct cursor {
+    const char *p, *end;
+    void need(size_t n) const {
+      if (size_t(end-p) < n) throw std::runtime_error("skim: truncated file");
+    }
+    template <typename T> T get() {
+      need(sizeof(T));
+      T x;
+      std::memcpy(&x, p, sizeof(T));
+      p += sizeof(T);
+      return x;
+    }
+    std::string str() {
+      const uint32_t n = get<uint32_t>();
+      need(n);
+      std::string s(p, n);
+      p += n;
+      return s;
+    }
+  };
+
+public:
+  file(const std::string& fname): _data(nullptr), _size(0) {
+    const int fd = ::open(fname.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("skim: cannot open "+fname);
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+      _size = st.st_size;
+      _data = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (!_data || _data == MAP_FAILED)
+      throw std::runtime_error("skim: cannot map "+fname);
+
+    cursor c { static_cast<const char*>(_data),
+               static_cast<const char*>(_data) + _size };
+    c.need(sizeof(magic));
+    if (std::memcmp(c.p, magic, sizeof(magic)-1))
+      throw std::runtime_error("skim: "+fname+" is not a skim file");
+    if (c.p[sizeof(magic)-1] != magic[sizeof(magic)-1])
+      throw std::runtime_error("skim: "+fname+" was written by another"
+                               " version of signif");
+    c.p += sizeof(magic);
+
+    _m_yy_range.first = c.get<double>();
+    _m_yy_range.second = c.get<double>();
+    const uint32_t ncols = c.get<uint32_t>(), nfiles = c.get<uint32_t>();
+    for (uint32_t i=0; i<ncols; ++i) {
+      std::string name = c.str();
+      _columns.push_back({std::move(name), bool(c.get<uint8_t>())});
+    }
+    for (uint32_t i=0; i<nfiles; ++i) {
+      entry e;
+      e.name = c.str();
+      e.mc = c.get<uint8_t>();
+      e.n_all = c.get<double>();
+      e.nevents = c.get<uint64_t>();
+      uint64_t offset = c.get<uint64_t>();
+      const uint64_t col_size = detail::aligned(e.nevents*sizeof(value));
+      if (offset + ncols*col_size > _size)
+        throw std::runtime_error("skim: truncated file");
+      for (uint32_t j=0; j<ncols; ++j, offset+=col_size)
+        e.cols.push_back(reinterpret_cast<const value*>(
+          static_cast<const char*>(_data) + offset));
+      _entries.push_back(std::move(e));
+    }
+  }
+  file(const file&) = delete;
+  ~file() { ::munmap(_data, _size); }
+
+  // m_yy range of the preselection
+  inline std::pair<double,double> m_yy_range() const noexcept {
+    return _m_yy_range;
+  }
+  inline const std::vector<column>& columns() const noexcept {
+    return _columns;
+  }
+  inline const std::vector<entry>& entries() const noexcept {
+    return _entries;
+  }
+
+  // Index of a column, which must have the declared type
+  size_t column_index(const std::string& name, bool is_int) const {
+    for (size_t i=0; i<_columns.size(); ++i) {
+      if (_columns[i].name!=name) continue;
+      if (_columns[i].is_int!=is_int)
+        throw std::runtime_error("skim: "+name+" is "
+          +(_columns[i].is_int ? "int" : "float")+", but is declared "
+          +(is_int ? "int" : "float"));
+      return i;
+    }
+    throw std::runtime_error("skim: no column "+name);
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef snip_spsc_queue_hh
+#define snip_spsc_queue_hh
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+/*
+ * Bounded lock-free queue for one producer and one consumer thread.
+ *
+ * Ring buffer of capacity elements. push() fails when the queue is
+ * full and pop() fails when it is empty, so the caller decides how to
+ * wait. Each thread only writes one of head and tail, and padding keeps
+ * them on separate cache lines (alignas would need over-aligned new,
+ * which C++11 does not provide).
+ */
+
+template <typename T>
+class spsc_queue {
+  std::vector<T> buf;
+  const size_t cap;
+  char pad0[64];
+  std::atomic<size_t> head; // next to pop, written by consumer
+  char pad1[64];
+  std::atomic<size_t> tail; // next to push, written by producer
+  char pad2[64];
+
+public:
+  spsc_queue(size_t capacity)
+  : buf(capacity+1), cap(capacity+1), head(0), tail(0) { }
+  spsc_queue(const spsc_queue&) = delete;
+
+  bool push(const T& x) noexcept {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    const size_t next = (t+1 == cap) ? 0 : t+1;
+    if (next == head.load(std::memory_order_acquire)) return false;
+    buf[t] = x;
+    tail.store(next, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T& x) noexcept {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) return false;
+    x = buf[h];
+    head.store((h+1 == cap) ? 0 : h+1, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const noexcept {
+    return head.load(std::memory_order_acquire)
+        == tail.load(std::memory_order_acquire);
+  }
+
+  inline size_t capacity() const noexcept { return cap-1; }
+};
+
+#endif
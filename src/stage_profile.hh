@@ -0,0 +1,108 @@
+#ifndef snip_stage_profile_hh
+#define snip_stage_profile_hh
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <ostream>
+#include <iomanip>
+
+/*
+ * Time spent in named stages of a program, per thread.
+ *
+ * Every thread adds to its own row of stage_time, so there is no
+ * synchronization; rows are summed when the profile is printed.
+ * A scoped_timer with a null stage does nothing, not even read the
+ * clock, so timers can stay in the code when profiling is disabled.
+ */
+
+struct stage_time {
+  double time;
+  unsigned long long calls;
+  stage_time(): time(0), calls(0) { }
+};
+
+class scoped_timer {
+  typedef std::chrono::steady_clock clock_type;
+  stage_time *s;
+  clock_type::time_point start;
+
+public:
+  scoped_timer(stage_time* s): s(s) { if (s) start = clock_type::now(); }
+  scoped_timer(const scoped_timer&) = delete;
+  ~scoped_timer() {
+    if (s) {
+      s->time += std::chrono::duration<double>(
+        clock_type::now() - start).count();
+      ++s->calls;
+    }
+  }
+};
+
+class stage_profile {
+  std::vector<std::string> names;
+  std::vector<std::vector<stage_time>> rows;
+
+public:
+  stage_profile(const std::vector<std::string>& names, unsigned nthreads)
+  : names(names), rows(nthreads, std::vector<stage_time>(names.size())) { }
+
+  // rows of stage_time are moved, not copied, so row pointers of
+  // existing threads stay valid
+  void resize(unsigned nthreads) {
+    rows.resize(nthreads, std::vector<stage_time>(names.size()));
+  }
+
+  // stages of thread i
+  inline stage_time* row(unsigned i) noexcept { return rows[i].data(); }
+
+  stage_time total(unsigned s) const noexcept {
+    stage_time t;
+    for (const auto& r : rows) {
+      t.time += r[s].time;
+      t.calls += r[s].calls;
+    }
+    return t;
+  }
+
+  // Time is summed over threads, so it can exceed the wall time
+  void print(std::ostream& os, double wall) const {
+    const std::ios::fmtflags flags(os.flags());
+    const auto prec = os.precision();
+    os << std::fixed;
+    double sum = 0;
+    for (size_t s=0; s<names.size(); ++s) sum += total(s).time;
+    os << std::left << std::setw(10) << "stage" << std::right
+       << std::setw(12) << "calls" << std::setw(12) << "time [s]"
+       << std::setw(8) << "%" << '\n';
+    for (size_t s=0; s<names.size(); ++s) {
+      const stage_time t = total(s);
+      os << std::left << std::setw(10) << names[s] << std::right
+         << std::setw(12) << t.calls
+         << std::setw(12) << std::setprecision(4) << t.time
+         << std::setw(8) << std::setprecision(1)
+         << (sum > 0 ? 100.*t.time/sum : 0.) << '\n';
+    }
+    os << std::left << std::setw(10) << "wall" << std::right
+       << std::setw(24) << std::setprecision(4) << wall << '\n';
+    os.flags(flags);
+    os.precision(prec);
+  }
+
+  // extra is written as is after the stages, e.g. "\"events\": 123"
+  void write_json(std::ostream& os, double wall,
+                  const std::string& extra = "") const {
+    os << "{\n  \"wall\": " << wall
+       << ",\n  \"stages\": {";
+    for (size_t s=0; s<names.size(); ++s) {
+      const stage_time t = total(s);
+      os << (s ? ",\n" : "\n") << "    \"" << names[s]
+         << "\": { \"calls\": " << t.calls << ", \"time\": " << t.time << " }";
+    }
+    os << "\n  }";
+    if (!extra.empty()) os << ",\n  " << extra;
+    os << "\n}\n";
+  }
+};
+
+#endif
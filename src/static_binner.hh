@@ -0,0 +1,133 @@
+#ifndef snip_static_binner_hh
+#define snip_static_binner_hh
+
+#include <array>
+#include <limits>
+#include <utility>
+#include <type_traits>
+
+#include "binner.hh"
+
+/*
+ * Binner with edges fixed at compile time.
+ *
+ * Edges are a constexpr array with static storage duration:
+ *
+ *   constexpr double pT_edges[] = { 0, 40e3, 60e3, 100e3, 200e3 };
+ *   static_binner<bkg_sig,double,5,pT_edges> h;
+ *
+ * find_bin is an unrolled compare-and-count over the edges, without
+ * branches or loads of the edge count, and is constexpr.
+ * Bins are kept in a std::array.
+ * Bin numbering and filling are the same as in binner.
+ */
+
+template <typename Bin, typename Edge, size_t N, const Edge (&Edges)[N],
+          typename Filler = binner_filler_default<Bin>>
+class static_binner {
+public:
+  typedef Bin    bin_t;
+  typedef Edge   edge_t;
+  typedef Filler filler_t;
+  typedef unsigned size_type;
+
+  static constexpr size_type nedges = N;
+
+protected:
+  std::array<bin_t,N+1> _bins;
+
+  template <size_type I>
+  using at = std::integral_constant<size_type,I>;
+
+  template <size_type I>
+  static constexpr size_type count(edge_t e, at<I>) noexcept {
+    return size_type(e >= Edges[I]) + count(e, at<I+1>());
+  }
+  static constexpr size_type count(edge_t, at<N>) noexcept { return 0; }
+
+  template <size_type I>
+  static constexpr bool sorted(at<I>) noexcept {
+    return Edges[I-1] < Edges[I] && sorted(at<I+1>());
+  }
+  static constexpr bool sorted(at<N>) noexcept { return true; }
+
+public:
+  static_binner(): _bins() {
+    static_assert(N > 0, "static_binner needs at least one edge");
+    static_assert(sorted(at<1>()), "static_binner edges must be increasing");
+  }
+
+  //---------------------------------------------
+
+  // Number of edges <= e, i.e. the bin index. NaN goes to underflow.
+  static constexpr size_type find_bin(edge_t e) noexcept {
+    return count(e, at<0>());
+  }
+
+  template <typename... TT>
+  size_type fill(edge_t e, TT&&... args)
+  noexcept(noexcept( filler_t()(std::declval<bin_t&>(),
+                                std::forward<TT>(args)...) ))
+  {
+    const size_type i = find_bin(e);
+    filler_t()(_bins[i], std::forward<TT>(args)...);
+    return i;
+  }
+
+  template <typename... TT>
+  inline size_type operator()(edge_t e, TT&&... args)
+  noexcept(noexcept(
+    std::declval<static_binner&>().fill(e, std::forward<TT>(args)...) ))
+  {
+    return fill(e, std::forward<TT>(args)...);
+  }
+
+  template <typename W>
+  void fill_n(const edge_t* x, const W* w, size_type n) {
+    for (size_type k=0; k<n; ++k) filler_t()(_bins[find_bin(x[k])], w[k]);
+  }
+
+  //---------------------------------------------
+
+  template <typename... TT>
+  void fill_bin(size_type i) { ++_bins.at(i); }
+
+  template <typename... TT>
+  void fill_bin(size_type i, TT&&... args) {
+    filler_t()(_bins.at(i), std::forward<TT>(args)...);
+  }
+
+  //---------------------------------------------
+
+  inline bin_t& operator[](size_type i) noexcept { return _bins[i]; }
+  inline const bin_t& operator[](size_type i) const noexcept {
+    return _bins[i];
+  }
+
+  inline bin_t& bin(size_type i) { return _bins.at(i); }
+  inline const bin_t& bin(size_type i) const { return _bins.at(i); }
+
+  //---------------------------------------------
+
+  static constexpr edge_t ledge(size_type i) noexcept {
+    return i ? Edges[i-1] : -std::numeric_limits<edge_t>::infinity();
+  }
+  static constexpr edge_t redge(size_type i) noexcept {
+    return i<N ? Edges[i] : std::numeric_limits<edge_t>::infinity();
+  }
+
+  //---------------------------------------------
+
+  static constexpr size_type nbins() noexcept { return N-1; }
+
+  static constexpr const edge_t (&edges() noexcept)[N] { return Edges; }
+  inline const std::array<bin_t,N+1>& bins() const noexcept { return _bins; }
+  inline std::array<bin_t,N+1>& bins() noexcept { return _bins; }
+};
+
+template <typename Bin, typename Edge, size_t N, const Edge (&Edges)[N],
+          typename Filler>
+constexpr typename static_binner<Bin,Edge,N,Edges,Filler>::size_type
+static_binner<Bin,Edge,N,Edges,Filler>::nedges;
+
+#endif
@@ -3,88 +3,187 @@
 
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <chrono>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <type_traits>
+
+namespace timed_counter_detail {
+
+using clock_type    = std::chrono::steady_clock;
+using time_type     = std::chrono::time_point<clock_type>;
+using duration_type = std::chrono::duration<double>;
+
+inline void print_time(std::ostream& os, double dt) {
+  using std::setw;
+  using std::setfill;
+  const long t = dt;
+  const int hours   = t/3600;
+  const int minutes = (t-hours*3600)/60;
+  const int seconds = (t-hours*3600-minutes*60);
+  if (hours) {
+    os << setw(5) << hours << ':'
+       << setfill('0') << setw(2) << minutes << ':'
+       << setw(2) << seconds << setfill(' ');
+  } else if (minutes) {
+    os << setw(2) << minutes << ':'
+       << setfill('0') << setw(2) << seconds << setfill(' ');
+  } else {
+    os << setw(2) << seconds <<'s';
+  }
+}
+
+// count | percent | elapsed | rate | [bytes rate |] ETA
+// The line is returned to its start, so that the next print overwrites it.
+inline void print_line(long long cnt, long long done, long long total,
+                       double dt, long long bytes = -1) {
+  std::ostringstream os;
+  os << std::setw(12) << cnt << " | ";
+  os.precision(2);
+  os << std::fixed << std::setw(6)
+     << (done && total ? 100.*double(done)/double(total) : 0.) << "% | ";
+  print_time(os,dt);
+  os.precision(3);
+  os.unsetf(std::ios::fixed);
+  const double rate = dt > 0 ? done/dt : 0.;
+  os << " | " << std::setw(9) << rate << " ev/s";
+  if (bytes >= 0)
+    os << " | " << std::setw(9) << (dt > 0 ? bytes/dt/1e6 : 0.) << " MB/s";
+  os << " | ETA ";
+  if (rate > 0 && total >= done) print_time(os,(total-done)/rate);
+  else os << " ?";
+  os << "   \r";
+  std::cout << os.str();
+  std::cout.flush();
+}
+
+}
+
+// Progress of several counters, e.g. of parallel workers,
+// reported on one line.
+// Counters add their counts in batches. Whichever thread adds counts
+// more than a second after the last print prints the line, so no thread
+// is dedicated to it, and the others never wait.
+class progress {
+  using clock_type = timed_counter_detail::clock_type;
+
+  std::atomic<long long> cnt, bytes;
+  const long long total;
+  const timed_counter_detail::time_type start;
+  std::atomic<long long> last; // ms since start
+  std::mutex print_mx;
+
+  long long ms() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+      clock_type::now() - start).count();
+  }
+
+  void print(long long t) {
+    std::unique_lock<std::mutex> lock(print_mx, std::try_to_lock);
+    if (!lock) return;
+    const long long n = cnt.load(std::memory_order_relaxed);
+    timed_counter_detail::print_line(n, n, total, t*1e-3,
+                                     bytes.load(std::memory_order_relaxed));
+  }
 
+public:
+  progress(long long total)
+  : cnt(0), bytes(0), total(total), start(clock_type::now()), last(0) { }
+  progress(const progress&) = delete;
+  ~progress() {
+    print(ms());
+    std::cout << std::endl;
+  }
+
+  void add(long long n, long long b = 0) {
+    cnt.fetch_add(n, std::memory_order_relaxed);
+    if (b) bytes.fetch_add(b, std::memory_order_relaxed);
+    const long long t = ms();
+    long long t0 = last.load(std::memory_order_relaxed);
+    if (t - t0 >= 1000 && last.compare_exchange_strong(t0,t)) print(t);
+  }
+};
+
+// Counter printing its progress about once a second.
+// The clock is only checked every check_every increments, so the
+// counter costs next to nothing in the innermost loop.
+// If a shared progress is given, counts are added to it instead,
+// and nothing is printed by the counter itself.
+// If a source of the number of bytes read is given, it is polled with
+// the clock, for bytes/s on the line.
 template <typename I, typename Compare = std::less<I>>
 class timed_counter {
 public:
   using value_type    = typename std::enable_if<std::is_integral<I>::value,I>::type;
   using compare_type  = Compare;
-  using clock_type    = std::chrono::system_clock;
-  using time_type     = std::chrono::time_point<clock_type>;
-  using duration_type = std::chrono::duration<double>;
+  using clock_type    = timed_counter_detail::clock_type;
+  using time_type     = timed_counter_detail::time_type;
+  using duration_type = timed_counter_detail::duration_type;
+
+  static constexpr unsigned check_every = 1u<<10;
 
 private:
   value_type cnt;
   const value_type cnt_start, cnt_end;
+  progress *shared;
+  std::function<long long()> bytes;
+  value_type reported;
+  long long bytes_reported;
+  unsigned since;
   const time_type start;
   time_type last;
   compare_type cmp;
 
   void print() {
-    using std::cout;
-    using std::setw;
-    using std::setfill;
-    std::ios::fmtflags f(cout.flags());
-    auto prec = cout.precision();
-
-    const auto dt = duration_type((last = clock_type::now()) - start).count();
-    const int hours   = dt/3600;
-    const int minutes = (dt-hours*3600)/60;
-    const int seconds = (dt-hours*3600-minutes*60);
-    int nb = 28;
-
-    cout << setw(12) << cnt << " | ";
-    cout.precision(2);
-    cout << std::fixed << setw(6) << (
-      cnt==cnt_start ? 0. : 100.*float(cnt-cnt_start)/float(cnt_end-cnt_start)
-    ) <<'%'<< " | ";
-    // cout.flags(f);
-    if (hours) {
-      nb += 8;
-      cout << setw(5) << hours << ':'
-      << setfill('0') << setw(2) << minutes << ':'
-      << setw(2) << seconds << setfill(' ');
-    } else if (minutes) {
-      nb += 2;
-      cout << setw(2) << minutes << ':'
-      << setfill('0') << setw(2) << seconds << setfill(' ');
-    } else {
-      cout << setw(2) << seconds <<'s';
-    }
-
-    cout.flush();
-    for (int i=0; i<nb; ++i) cout << '\b';
-    cout.flags(f);
-    cout.precision(prec);
+    last = clock_type::now();
+    timed_counter_detail::print_line(cnt, cnt-cnt_start, cnt_end-cnt_start,
+      duration_type(last - start).count(), bytes ? bytes() : -1);
+  }
+  void report() {
+    const long long b = bytes ? bytes() : 0;
+    shared->add(cnt-reported, b-bytes_reported);
+    reported = cnt;
+    bytes_reported = b;
   }
-  void print_check() {
-    if ( duration_type(clock_type::now()-last).count() > 1 ) print();
+  void tick() {
+    if (shared) report();
+    else if ( duration_type(clock_type::now()-last).count() > 1 ) print();
+  }
+  inline void check() {
+    if (!(++since & (check_every-1))) tick();
   }
 
 public:
-  timed_counter(I i, I n)
-  : cnt(i), cnt_start(i), cnt_end(n), start(clock_type::now()), last(start)
-  { print(); }
+  timed_counter(I i, I n, progress* shared = nullptr,
+                std::function<long long()> bytes = nullptr)
+  : cnt(i), cnt_start(i), cnt_end(n), shared(shared), bytes(std::move(bytes)),
+    reported(i), bytes_reported(0), since(0),
+    start(clock_type::now()), last(start)
+  { if (!shared) print(); }
   timed_counter(I n)
-  : cnt(0), cnt_start(0), cnt_end(n), start(clock_type::now()), last(start)
-  { print(); }
-  ~timed_counter() { print(); std::cout << std::endl; }
+  : timed_counter(0,n) { }
+  timed_counter(const timed_counter&) = delete;
+  ~timed_counter() {
+    if (shared) report();
+    else { print(); std::cout << std::endl; }
+  }
 
   inline bool ok() const noexcept { return cmp(cnt,cnt_end); }
 
   // prefix
-  inline I operator++() { print_check(); return ++cnt; }
-  inline I operator--() { print_check(); return --cnt; }
+  inline I operator++() { check(); return ++cnt; }
+  inline I operator--() { check(); return --cnt; }
 
   // postfix
-  inline I operator++(int) { print_check(); return cnt++; }
-  inline I operator--(int) { print_check(); return cnt--; }
+  inline I operator++(int) { check(); return cnt++; }
+  inline I operator--(int) { check(); return cnt--; }
 
   template <typename T>
-  inline I operator+= (T i) { print_check(); return cnt += i; }
+  inline I operator+= (T i) { check(); return cnt += i; }
   template <typename T>
-  inline I operator-= (T i) { print_check(); return cnt -= i; }
+  inline I operator-= (T i) { check(); return cnt -= i; }
 
   template <typename T>
   inline bool operator<  (T i) const noexcept { return cnt <  i; }
@@ -109,4 +208,7 @@ public:
   }
 };
 
+template <typename I, typename Compare>
+constexpr unsigned timed_counter<I,Compare>::check_every;
+
 #endif
@@ -1,6 +1,7 @@
 #ifndef snip_type_traits_extra_hh
 #define snip_type_traits_extra_hh
 
+#include <cstddef>
 #include <type_traits>
 #include <tuple>
 
@@ -0,0 +1,73 @@
+#ifndef snip_work_stealing_hh
+#define snip_work_stealing_hh
+
+#include <vector>
+#include <deque>
+#include <iterator>
+#include <mutex>
+
+/*
+ * One task deque per thread.
+ * A thread takes tasks from the front of its own deque, and once that
+ * is empty, steals from the back of the other threads' deques.
+ * Tasks are initially distributed in contiguous slices, so neighbouring
+ * tasks (e.g. consecutive entry ranges of the same file) tend to be
+ * processed by the same thread.
+ */
+
+template <typename T>
+class work_stealing {
+  struct queue {
+    std::mutex mx;
+    std::deque<T> tasks;
+  };
+  std::vector<queue> queues;
+
+public:
+  typedef T task_t;
+
+  work_stealing(unsigned nthreads): queues(nthreads ? nthreads : 1) { }
+
+  inline unsigned size() const noexcept { return queues.size(); }
+
+  template <typename InputIterator>
+  void distribute(InputIterator first, InputIterator last) {
+    const size_t n = std::distance(first,last);
+    const size_t nq = queues.size();
+    for (size_t i=0, q=0; first!=last; ++first, ++i) {
+      while (i >= (n*(q+1))/nq) ++q;
+      std::lock_guard<std::mutex> lock(queues[q].mx);
+      queues[q].tasks.push_back(*first);
+    }
+  }
+
+  bool pop(unsigned tid, T& task) {
+    { queue& q = queues[tid];
+      std::lock_guard<std::mutex> lock(q.mx);
+      if (!q.tasks.empty()) {
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        return true;
+      }
+    }
+    for (unsigned i=1; i<queues.size(); ++i) {
+      queue& q = queues[(tid+i)%queues.size()];
+      std::lock_guard<std::mutex> lock(q.mx);
+      if (!q.tasks.empty()) {
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void clear() {
+    for (auto& q : queues) {
+      std::lock_guard<std::mutex> lock(q.mx);
+      q.tasks.clear();
+    }
+  }
+};
+
+#endif